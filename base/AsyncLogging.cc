@@ -1,6 +1,6 @@
 #include <base/AsyncLogging.h>
 #include <base/LogFile.h>
-#include <base/Timestamp.h>
+#include <base/timestamp.h>
 
 #include <stdio.h>
 
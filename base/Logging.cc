@@ -2,7 +2,7 @@
 
 #include <base/CurrentThread.h>
 #include <base/string_piece.h>
-#include <base/Timestamp.h>
+#include <base/timestamp.h>
 
 #include <errno.h>
 #include <stdio.h>
@@ -2,7 +2,7 @@
 #define BASE_PROCESSINFO_H_
 
 #include <base/Types.h>
-#include <base/Timestamp.h>
+#include <base/timestamp.h>
 #include <vector>
 
 namespace cobra
@@ -0,0 +1,16 @@
+#ifndef BASE_COPYABLE_H_
+#define BASE_COPYABLE_H_
+
+namespace cobra
+{
+
+/// A tag class emphasises the objects are copyable.
+/// The empty base class optimization applies.
+/// Any derived class of copyable should be a value type.
+class copyable
+{
+};
+
+}  // namespace cobra
+
+#endif  // BASE_COPYABLE_H_
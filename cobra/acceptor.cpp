@@ -12,7 +12,11 @@
 
 namespace cobra {
 
-Acceptor::Acceptor(Worker* loop, const Endpoint& listen_address)
+const int Acceptor::kMaxAcceptsPerWakeup;
+
+Acceptor::Acceptor(Worker* loop,
+                   const Endpoint& listen_address,
+                   bool reuse_port)
   : loop_(loop),
     listen_fd_(createNonblockingOrDie()),
     accept_channel_(loop, listen_fd_),
@@ -20,7 +24,9 @@ Acceptor::Acceptor(Worker* loop, const Endpoint& listen_address)
     idle_fd_(::open("/dev/null", O_RDONLY | O_CLOEXEC)) {
   assert(idle_fd_ >= 0);
   SetReuseAddr(listen_fd_, true);
-  //SetReusePort(listen_fd_, reuseport);
+  if (reuse_port) {
+    SetReusePort(listen_fd_, true);
+  }
   Bind(listen_fd_, listen_address);
 
   // When there is a connection request coming on the listening port,
@@ -49,26 +55,50 @@ void Acceptor::Listen() {
 void Acceptor::HandleRead() {
   loop_->assertInLoopThread();
 
-  Endpoint peer_address(0);
-  //FIXME loop until no more
-  int connfd = Accept(listen_fd_, &peer_address);
-  if (connfd >= 0) {
-    if (new_conn_cb_) {
+  // Accept until there's no more, the backlog may be long.
+  int n = 0;
+  while (n < kMaxAcceptsPerWakeup) {
+    Endpoint peer_address(0);
+    int connfd = Accept(listen_fd_, &peer_address);
+    if (connfd < 0) {
+      if (errno != EAGAIN) {
+        HandleAcceptError();
+      }
+      break;
+    }
+
+    ++n;
+    if (new_conns_cb_) {
+      accepted_.push_back(Accepted(connfd, peer_address));
+    } else if (new_conn_cb_) {
       new_conn_cb_(connfd, peer_address);
     } else {
       close(connfd);
     }
-  } else {
-    LOG_SYSERR << "in Acceptor::handleRead";
-    // Read the section named "The special problem of
-    // accept()ing when you can't" in libev's doc.
-    // By Marc Lehmann, author of libev.
-    if (errno == EMFILE) {
-      ::close(idle_fd_);
-      idle_fd_ = ::accept(listen_fd_, NULL, NULL);
-      ::close(idle_fd_);
-      idle_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
-    }
+  }
+
+  wakeups_.increment();
+  accepted_count_.add(n);
+  if (n > max_accepted_.get()) {
+    max_accepted_.getAndSet(n);
+  }
+
+  if (!accepted_.empty()) {
+    new_conns_cb_(accepted_);
+    accepted_.clear();
+  }
+}
+
+void Acceptor::HandleAcceptError() {
+  LOG_SYSERR << "in Acceptor::handleRead";
+  // Read the section named "The special problem of
+  // accept()ing when you can't" in libev's doc.
+  // By Marc Lehmann, author of libev.
+  if (errno == EMFILE) {
+    ::close(idle_fd_);
+    idle_fd_ = ::accept(listen_fd_, NULL, NULL);
+    ::close(idle_fd_);
+    idle_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
   }
 }
 
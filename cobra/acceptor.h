@@ -5,25 +5,37 @@
 #ifndef COBRA_ACCEPTOR_H_
 #define COBRA_ACCEPTOR_H_
 
+#include <utility>
+#include <vector>
+
 #include <boost/function.hpp>
 #include <boost/noncopyable.hpp>
 
+#include "base/Atomic.h"
 #include "base/basic_types.h"
 #include "base/macros.h"
 #include "cobra/channel.h"
+#include "cobra/endpoint.h"
 
 namespace cobra {
 
 class Worker;
-class Endpoint;
 
 // Acceptor of incoming TCP connections.
 class Acceptor {
  public:
   typedef boost::function<void (int sockfd,
                                 const Endpoint&)> NewConnectionCb;
+  typedef std::pair<int, Endpoint> Accepted;
+  typedef std::vector<Accepted> AcceptedList;
+  typedef boost::function<void (const AcceptedList&)> NewConnectionsCb;
 
-  Acceptor(Worker* loop, const Endpoint& listen_address);
+  // With 'reuse_port', several acceptors (usually one per loop) may
+  // listen on the same address, and the kernel spreads the incoming
+  // connections among them.
+  Acceptor(Worker* loop,
+           const Endpoint& listen_address,
+           bool reuse_port = false);
   ~Acceptor();
 
   // Called when a new connecion comes
@@ -31,16 +43,47 @@ class Acceptor {
     new_conn_cb_ = cb;
   }
 
+  // Called once per wakeup with all the connections accepted, instead
+  // of once per connection. Takes precedence over NewConnectionCb.
+  void SetNewConnectionsCb(const NewConnectionsCb& cb) {
+    new_conns_cb_ = cb;
+  }
+
+  inline Worker* GetWorker() const { return loop_; }
   inline bool Listenning() const { return listenning_; }
   void Listen();
 
+  ////////////////////// begin /////////////////////////////////
+  // accept statistics, safe to read from other threads.
+
+  // Number of readable events handled.
+  int64 AcceptWakeups() { return wakeups_.get(); }
+
+  // Number of connections accepted.
+  int64 AcceptedConnections() { return accepted_count_.get(); }
+
+  // The most connections accepted by one wakeup.
+  int32 MaxAcceptedPerWakeup() { return max_accepted_.get(); }
+  ///////////////////////// end ///////////////////////////////
+
  private:
+  // Bounds the accept loop of one wakeup, to let the other channels of
+  // the loop have their turn under connection storms.
+  static const int kMaxAcceptsPerWakeup = 256;
+
   void HandleRead();
+  void HandleAcceptError();
 
   Worker* loop_;
   int32 listen_fd_;
   Channel accept_channel_;
   NewConnectionCb new_conn_cb_;
+  NewConnectionsCb new_conns_cb_;
+  // Reused across wakeups.
+  AcceptedList accepted_;
+  AtomicInt64 wakeups_;
+  AtomicInt64 accepted_count_;
+  AtomicInt32 max_accepted_;
   bool listenning_;
   int32 idle_fd_;
 
@@ -0,0 +1,206 @@
+// Author: Jianbo Zhu
+//
+// Heap allocations of a TcpConnection::send from another thread than the
+// one of the connection, counted by replacing the global operator new.
+//
+// "string+bind" is what send(data, len) used to do: copy the message into
+// a string, bind it, post that to the loop which writes it or appends it
+// to the output buffer. The others are the sends as they are now. The
+// count covers both threads, from the send to the write in the loop.
+//
+// A reader thread drains the other end of the connection, so most sends
+// are written right away.
+//
+// Usage: cross_thread_send_bench [port]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <cstddef>
+#include <new>
+#include <string>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "base/CountDownLatch.h"
+#include "base/Logging.h"
+#include "base/timestamp.h"
+#include "cobra/buffer.h"
+#include "cobra/server.h"
+#include "cobra/socket_wrapper.h"
+#include "cobra/tcp_connection.h"
+#include "cobra/worker.h"
+
+namespace {
+
+volatile long g_allocs = 0;
+
+}  // Anonymous namespace
+
+// No dynamic exception specification, deprecated in C++11 and gone in
+// C++17.
+#if __cplusplus >= 201103L
+#define COBRA_BENCH_NOEXCEPT noexcept
+#else
+#define COBRA_BENCH_NOEXCEPT throw()
+#endif
+
+void* operator new(std::size_t size) {
+  __sync_fetch_and_add(&g_allocs, 1);
+  void* p = ::malloc(size == 0 ? 1 : size);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) COBRA_BENCH_NOEXCEPT {
+  ::free(p);
+}
+
+void operator delete[](void* p) COBRA_BENCH_NOEXCEPT {
+  ::free(p);
+}
+
+// The sized versions C++14 calls instead.
+void operator delete(void* p, std::size_t) COBRA_BENCH_NOEXCEPT {
+  ::free(p);
+}
+
+void operator delete[](void* p, std::size_t) COBRA_BENCH_NOEXCEPT {
+  ::free(p);
+}
+
+namespace {
+
+const int kSends = 200 * 1000;
+
+cobra::TcpConnectionPtr g_conn;
+cobra::CountDownLatch g_connected(1);
+
+void onConnection(const cobra::TcpConnectionPtr& conn) {
+  if (conn->connected()) {
+    g_conn = conn;
+    g_connected.countDown();
+  }
+}
+
+// The other end of the connection.
+void drain(int fd) {
+  char buf[64 * 1024];
+  while (::read(fd, buf, sizeof buf) > 0) {
+  }
+}
+
+void sendString(const cobra::TcpConnectionPtr& conn,
+                const std::string& message) {
+  conn->send(message.data(), message.size());
+}
+
+enum Mode {
+  kStringBind,
+  kSendData,
+  kSendBuffer
+};
+
+const char* const kModeNames[] = {
+  "string+bind",
+  "send(data, len)",
+  "send(Buffer*)"
+};
+
+void sendOnce(Mode mode, const std::string& payload, cobra::Buffer* buf) {
+  switch (mode) {
+    case kStringBind:
+      g_conn->getLoop()->runInLoop(
+          boost::bind(sendString, g_conn,
+                      std::string(payload.data(), payload.size())));
+      break;
+    case kSendData:
+      g_conn->send(payload.data(), payload.size());
+      break;
+    case kSendBuffer:
+      buf->append(payload.data(), payload.size());
+      g_conn->send(buf);
+      break;
+  }
+}
+
+void run(Mode mode, size_t size) {
+  const std::string payload(size, 'x');
+  cobra::Buffer buf;
+
+  const long before = g_allocs;
+  const cobra::Timestamp start = cobra::Timestamp::now();
+  for (int i = 0; i < kSends; ++i) {
+    sendOnce(mode, payload, &buf);
+  }
+  // Functors run in order, all the sends are done after this one.
+  cobra::CountDownLatch done(1);
+  g_conn->getLoop()->runInLoop(
+      boost::bind(&cobra::CountDownLatch::countDown, &done));
+  done.wait();
+  const double seconds =
+      cobra::timeDifference(cobra::Timestamp::now(), start);
+  // The latch functor itself.
+  const long allocs = g_allocs - before - 1;
+
+  printf("%8zu %16s %12.2f %12.0f\n", size, kModeNames[mode],
+         static_cast<double>(allocs) / kSends, kSends / seconds);
+}
+
+void bench(cobra::Worker* loop, int port) {
+  const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  ::memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                sizeof addr) < 0) {
+    perror("connect");
+    exit(1);
+  }
+  boost::thread reader(boost::bind(drain, fd));
+  g_connected.wait();
+
+  printf("%8s %16s %12s %12s\n", "bytes", "send", "allocs/send",
+         "sends/s");
+  const size_t sizes[] = { 64, 1024, 16 * 1024 };
+  for (size_t i = 0; i < sizeof sizes / sizeof sizes[0]; ++i) {
+    run(kStringBind, sizes[i]);
+    run(kSendData, sizes[i]);
+    run(kSendBuffer, sizes[i]);
+  }
+
+  ::shutdown(fd, SHUT_RDWR);
+  reader.join();
+  ::close(fd);
+  g_conn.reset();
+  loop->Quit();
+}
+
+}  // Anonymous namespace
+
+int main(int argc, char* argv[]) {
+  cobra::Logger::setLogLevel(cobra::Logger::WARN);
+  const int port = argc > 1 ? atoi(argv[1]) : 9981;
+
+  cobra::Worker loop;
+  cobra::Server server(&loop, cobra::Endpoint(static_cast<uint16>(port)),
+                       "send_bench");
+  // The connection in its own thread, the sends come from ours.
+  server.SetThreadNum(1);
+  server.SetConnectionCb(onConnection);
+  server.start();
+
+  boost::thread sender(boost::bind(bench, &loop, port));
+  loop.Loop();
+  sender.join();
+  return 0;
+}
@@ -0,0 +1,150 @@
+// Author: Jianbo Zhu
+//
+// Frames per second of LengthHeaderCodec on small messages, in memory:
+// a stream of frames is fed to its framing, LengthHeaderFramer::decode,
+// in chunks the size of a read, so frames straddle chunks as they would
+// straddle reads. The codec only adds the connection to each frame.
+//
+// "copy loop" is the framing loop users used to write in their message
+// callbacks, peekInt32 then retrieveAsString, for comparison.
+//
+// Usage: length_header_codec_bench [rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "base/timestamp.h"
+#include "cobra/buffer.h"
+#include "cobra/length_header_framer.h"
+
+namespace {
+
+using cobra::Buffer;
+using cobra::LengthHeaderFramer;
+using cobra::StringPiece;
+using cobra::string;
+using cobra::Timestamp;
+
+// A typical read.
+const size_t kReadSize = 16 * 1024;
+const int kFramesPerStream = 10000;
+
+const char* const kTypeNames[] = { "int16", "int32", "varint" };
+
+int64 g_frames = 0;
+size_t g_bytes = 0;
+
+struct FrameCounter {
+  void operator()(const StringPiece& frame) {
+    ++g_frames;
+    g_bytes += static_cast<size_t>(frame.size());
+  }
+};
+
+// 'n' frames of 'size' bytes each, framed by 'framer'.
+string makeStream(const LengthHeaderFramer& framer, size_t size, int n) {
+  const string payload(size, 'x');
+  string stream;
+  for (int i = 0; i < n; ++i) {
+    Buffer frame;
+    frame.append(payload);
+    framer.encode(&frame);
+    stream.append(frame.BeginRead(), frame.readableBytes());
+  }
+  return stream;
+}
+
+// The frames of 'stream', the way users did it by hand.
+void copyLoop(Buffer* input) {
+  while (input->readableBytes() >= sizeof(int32_t)) {
+    const size_t len = static_cast<size_t>(input->peekInt32());
+    if (input->readableBytes() < sizeof(int32_t) + len) {
+      break;
+    }
+    input->retrieveInt32();
+    const string frame = input->retrieveAsString(len);
+    ++g_frames;
+    g_bytes += frame.size();
+  }
+}
+
+// @return frames per second
+double decode(const LengthHeaderFramer& framer,
+              const string& stream,
+              int rounds,
+              bool copy) {
+  FrameCounter counter;
+  size_t badLength = 0;
+  Buffer input;
+  g_frames = 0;
+  const Timestamp start = Timestamp::now();
+  for (int r = 0; r < rounds; ++r) {
+    for (size_t off = 0; off < stream.size(); off += kReadSize) {
+      const size_t len = std::min(kReadSize, stream.size() - off);
+      input.append(stream.data() + off, len);
+      if (copy) {
+        copyLoop(&input);
+      } else {
+        if (!framer.decode(&input, counter, &badLength)) {
+          fprintf(stderr, "bad frame header, length %zu\n", badLength);
+          exit(1);
+        }
+      }
+    }
+  }
+  const double seconds = cobra::timeDifference(Timestamp::now(), start);
+  if (g_frames != static_cast<int64>(rounds) * kFramesPerStream) {
+    fprintf(stderr, "lost frames: %lld\n", static_cast<long long>(g_frames));
+    exit(1);
+  }
+  return static_cast<double>(g_frames) / seconds;
+}
+
+// @return frames per second
+double encode(const LengthHeaderFramer& framer, size_t size, int rounds) {
+  const string payload(size, 'x');
+  const int n = rounds * kFramesPerStream;
+  size_t total = 0;
+  const Timestamp start = Timestamp::now();
+  for (int i = 0; i < n; ++i) {
+    Buffer frame;
+    frame.append(payload);
+    framer.encode(&frame);
+    total += frame.readableBytes();
+  }
+  const double seconds = cobra::timeDifference(Timestamp::now(), start);
+  // Keeps the loop from being optimized away.
+  g_bytes += total;
+  return n / seconds;
+}
+
+}  // Anonymous namespace
+
+int main(int argc, char* argv[]) {
+  const int rounds = argc > 1 ? atoi(argv[1]) : 200;
+  const size_t sizes[] = { 16, 64, 256, 1024 };
+
+  printf("%8s %10s %16s %16s\n", "bytes", "header", "decode frames/s",
+         "encode frames/s");
+  for (size_t i = 0; i < sizeof sizes / sizeof sizes[0]; ++i) {
+    for (int type = LengthHeaderFramer::kInt16;
+         type <= LengthHeaderFramer::kVarint;
+         ++type) {
+      const LengthHeaderFramer framer(
+          static_cast<LengthHeaderFramer::HeaderType>(type));
+      const string stream =
+          makeStream(framer, sizes[i], kFramesPerStream);
+      printf("%8zu %10s %16.0f %16.0f\n", sizes[i], kTypeNames[type],
+             decode(framer, stream, rounds, false),
+             encode(framer, sizes[i], rounds));
+    }
+
+    const LengthHeaderFramer framer(LengthHeaderFramer::kInt32);
+    const string stream = makeStream(framer, sizes[i], kFramesPerStream);
+    printf("%8zu %10s %16.0f %16s\n", sizes[i], "copy loop",
+           decode(framer, stream, rounds, true), "-");
+  }
+  return 0;
+}
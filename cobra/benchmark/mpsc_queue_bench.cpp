@@ -0,0 +1,132 @@
+// Author: Jianbo Zhu
+//
+// The pending functors of a Worker under contention: the mutex guarded
+// vector Worker used to have against MpscQueue.
+//
+// N producers post kPostsPerProducer functors each while one consumer
+// drains them the way Worker::doPendingFunctors does, the time is from
+// the first post to the last functor run.
+//
+// Usage: mpsc_queue_bench [max producers]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread.hpp>
+
+#include "base/timestamp.h"
+#include "cobra/mpsc_queue.h"
+
+namespace {
+
+typedef boost::function<void ()> Functor;
+
+const int kPostsPerProducer = 1000 * 1000;
+
+// What the functors do, the consumer counts them.
+int64 g_ran = 0;
+
+void work() {
+  ++g_ran;
+}
+
+// The queue Worker had before MpscQueue.
+class MutexQueue {
+ public:
+  void push(const Functor& cb) {
+    boost::mutex::scoped_lock lock(mutex_);
+    pending_.push_back(cb);
+  }
+
+  // Runs what is queued now.
+  void drain() {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      running_.swap(pending_);
+    }
+    for (size_t i = 0; i < running_.size(); ++i) {
+      running_[i]();
+    }
+    running_.clear();
+  }
+
+ private:
+  boost::mutex mutex_;
+  std::vector<Functor> pending_;
+  std::vector<Functor> running_;
+};
+
+class LockFreeQueue {
+ public:
+  void push(const Functor& cb) {
+    pending_.push(cb);
+  }
+
+  void drain() {
+    Functor functor;
+    while (pending_.pop(&functor)) {
+      running_.push_back(Functor());
+      running_.back().swap(functor);
+    }
+    for (size_t i = 0; i < running_.size(); ++i) {
+      running_[i]();
+    }
+    running_.clear();
+  }
+
+ private:
+  cobra::MpscQueue<Functor> pending_;
+  std::vector<Functor> running_;
+};
+
+template <typename Queue>
+void produce(Queue* queue) {
+  const Functor cb(work);
+  for (int i = 0; i < kPostsPerProducer; ++i) {
+    queue->push(cb);
+  }
+}
+
+// @return posts per second
+template <typename Queue>
+double run(int producers) {
+  Queue queue;
+  g_ran = 0;
+  const int64 total = static_cast<int64>(producers) * kPostsPerProducer;
+
+  const cobra::Timestamp start = cobra::Timestamp::now();
+  boost::ptr_vector<boost::thread> threads;
+  for (int i = 0; i < producers; ++i) {
+    threads.push_back(
+        new boost::thread(boost::bind(&produce<Queue>, &queue)));
+  }
+  while (g_ran < total) {
+    queue.drain();
+  }
+  const double seconds =
+      cobra::timeDifference(cobra::Timestamp::now(), start);
+  for (int i = 0; i < producers; ++i) {
+    threads[i].join();
+  }
+  return static_cast<double>(total) / seconds;
+}
+
+}  // Anonymous namespace
+
+int main(int argc, char* argv[]) {
+  const int maxProducers = argc > 1 ? atoi(argv[1]) : 8;
+
+  printf("%10s %16s %16s %8s\n", "producers", "mutex posts/s",
+         "mpsc posts/s", "speedup");
+  for (int n = 1; n <= maxProducers; n *= 2) {
+    const double mutex = run<MutexQueue>(n);
+    const double mpsc = run<LockFreeQueue>(n);
+    printf("%10d %16.0f %16.0f %7.2fx\n", n, mutex, mpsc, mpsc / mutex);
+  }
+  return 0;
+}
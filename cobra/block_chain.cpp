@@ -0,0 +1,269 @@
+#include "cobra/block_chain.h"
+
+#include <errno.h>
+#include <strings.h>  // bzero
+#include <sys/socket.h>
+
+#include <algorithm>
+
+#include "base/Types.h"
+#include "cobra/socket_wrapper.h"
+
+namespace cobra {
+
+const size_t Block::kDefaultCapacity;
+const int BlockChain::kMaxIovecs;
+const size_t BlockChain::kMaxSpareBlocks;
+
+Block::Block(size_t capacity)
+  : data_(new char[capacity]),
+    size_(0),
+    capacity_(capacity),
+    owned_(true) {
+}
+
+Block::Block(const void* data, size_t len, const ReleaseCb& release)
+  : data_(static_cast<char*>(const_cast<void*>(data))),
+    size_(len),
+    capacity_(len),
+    owned_(false),
+    release_(release) {
+}
+
+Block::~Block() {
+  if (owned_) {
+    delete[] data_;
+  } else if (release_) {
+    release_();
+  }
+}
+
+BlockChain::BlockChain()
+  : readable_(0),
+    zeroCopyThreshold_(0),
+    zeroCopySeq_(0) {
+}
+
+BlockChain::~BlockChain() {
+  retrieveAll();
+}
+
+BlockPtr BlockChain::newBlock() {
+  if (!spares_.empty()) {
+    BlockPtr block(spares_.back());
+    spares_.pop_back();
+    return block;
+  }
+  return BlockPtr(new Block);
+}
+
+void BlockChain::append(const void* data, size_t len) {
+  const char* p = static_cast<const char*>(data);
+  while (len > 0) {
+    if (segments_.empty() || !segments_.back().appendable
+        || segments_.back().block->writableBytes() == 0) {
+      if (!segments_.empty()) {
+        segments_.back().appendable = false;
+      }
+      Segment segment;
+      segment.block = newBlock();
+      segment.begin = segment.block->data();
+      segment.len = 0;
+      segment.appendable = true;
+      segment.fd = -1;
+      segment.offset = 0;
+      segments_.push_back(segment);
+    }
+
+    Segment& tail = segments_.back();
+    size_t n = std::min(len, tail.block->writableBytes());
+    tail.block->append(p, n);
+    tail.len += n;
+    readable_ += n;
+    p += n;
+    len -= n;
+  }
+}
+
+void BlockChain::append(const BlockPtr& block, size_t offset, size_t len) {
+  assert(offset + len <= block->size());
+  if (len == 0) {
+    return;
+  }
+  if (!segments_.empty()) {
+    // Keep the order, copies go after this block from now on.
+    segments_.back().appendable = false;
+  }
+
+  Segment segment;
+  segment.block = block;
+  segment.begin = block->data() + offset;
+  segment.len = len;
+  segment.appendable = false;
+  segment.fd = -1;
+  segment.offset = 0;
+  segments_.push_back(segment);
+  readable_ += len;
+}
+
+void BlockChain::appendFile(int fd, off_t offset, size_t len) {
+  if (len == 0) {
+    cobra::close(fd);
+    return;
+  }
+  if (!segments_.empty()) {
+    segments_.back().appendable = false;
+  }
+
+  Segment segment;
+  segment.begin = NULL;
+  segment.len = len;
+  segment.appendable = false;
+  segment.fd = fd;
+  segment.offset = offset;
+  segments_.push_back(segment);
+  readable_ += len;
+}
+
+void BlockChain::popFront() {
+  Segment& front = segments_.front();
+  readable_ -= front.len;
+  if (front.fd >= 0) {
+    cobra::close(front.fd);
+  } else if (front.block->owned() && front.block.unique()
+             && spares_.size() < kMaxSpareBlocks) {
+    // Recycle our blocks nobody else refers to.
+    front.block->clear();
+    spares_.push_back(front.block);
+  }
+  segments_.pop_front();
+}
+
+void BlockChain::retrieve(size_t len) {
+  assert(len <= readable_);
+  while (len > 0) {
+    Segment& front = segments_.front();
+    if (len < front.len) {
+      if (front.fd >= 0) {
+        front.offset += len;
+      } else {
+        front.begin += len;
+      }
+      front.len -= len;
+      readable_ -= len;
+      return;
+    }
+    len -= front.len;
+    popFront();
+  }
+}
+
+void BlockChain::retrieveAll() {
+  while (!segments_.empty()) {
+    popFront();
+  }
+  assert(readable_ == 0);
+}
+
+ssize_t BlockChain::writeFd(int fd, int* savedErrno) {
+  if (!segments_.empty() && segments_.front().fd >= 0) {
+    return sendFileFront(fd, savedErrno);
+  }
+
+  // The blocks up to the next file region.
+  iovec vec[kMaxIovecs];
+  const int iovcnt = peek(vec, kMaxIovecs);
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    total += vec[i].iov_len;
+  }
+
+  ssize_t n = -1;
+  bool zeroCopy = false;
+#ifdef MSG_ZEROCOPY
+  if (zeroCopyThreshold_ > 0 && total >= zeroCopyThreshold_) {
+    msghdr msg;
+    bzero(&msg, sizeof msg);
+    msg.msg_iov = vec;
+    msg.msg_iovlen = iovcnt;
+    n = cobra::sendmsg(fd, &msg, MSG_ZEROCOPY);
+    // ENOBUFS: too many pages pinned already, copy this time.
+    zeroCopy = n >= 0 || errno != ENOBUFS;
+  }
+#endif
+  if (!zeroCopy) {
+    n = cobra::writev(fd, vec, iovcnt);
+  }
+
+  if (n < 0) {
+    *savedErrno = errno;
+  } else {
+    if (zeroCopy) {
+      pin(implicit_cast<size_t>(n));
+    }
+    retrieve(implicit_cast<size_t>(n));
+  }
+  return n;
+}
+
+int BlockChain::peek(iovec* vec, int maxIovecs) const {
+  int iovcnt = 0;
+  for (std::deque<Segment>::const_iterator it = segments_.begin();
+      it != segments_.end() && it->fd < 0 && iovcnt < maxIovecs; ++it) {
+    vec[iovcnt].iov_base = const_cast<char*>(it->begin);
+    vec[iovcnt].iov_len = it->len;
+    ++iovcnt;
+  }
+  return iovcnt;
+}
+
+void BlockChain::pin(size_t len) {
+  for (std::deque<Segment>::const_iterator it = segments_.begin();
+      len > 0; ++it) {
+    if (pins_.empty() || pins_.back().seq != zeroCopySeq_
+        || pins_.back().block != it->block) {
+      Pin p;
+      p.seq = zeroCopySeq_;
+      p.block = it->block;
+      pins_.push_back(p);
+    }
+    len -= std::min(len, it->len);
+  }
+  ++zeroCopySeq_;
+}
+
+void BlockChain::zeroCopyCompleted(uint32 lo, uint32 hi) {
+  // Usually the oldest pins, but completions may come out of order.
+  const uint32 count = hi - lo;
+  std::deque<Pin>::iterator it = pins_.begin();
+  while (it != pins_.end()) {
+    if (static_cast<uint32>(it->seq - lo) <= count) {
+      it = pins_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void BlockChain::takePins(BlockChain* other) {
+  pins_.insert(pins_.end(), other->pins_.begin(), other->pins_.end());
+  other->pins_.clear();
+}
+
+ssize_t BlockChain::sendFileFront(int fd, int* savedErrno) {
+  Segment& front = segments_.front();
+  off_t offset = front.offset;
+  const ssize_t n = cobra::sendfile(fd, front.fd, &offset, front.len);
+  if (n < 0) {
+    *savedErrno = errno;
+  } else if (n == 0) {
+    // End of file before the end of the region.
+    *savedErrno = EIO;
+    return -1;
+  } else {
+    retrieve(implicit_cast<size_t>(n));
+  }
+  return n;
+}
+
+}  // namespace cobra
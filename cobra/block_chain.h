@@ -0,0 +1,199 @@
+// Author: Jianbo Zhu
+//
+// Reference counted blocks of bytes, and a chain of them (and of file
+// regions) used as the output buffer of TcpConnection.
+
+#ifndef COBRA_BLOCK_CHAIN_H_
+#define COBRA_BLOCK_CHAIN_H_
+
+#include <assert.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <deque>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "base/basic_types.h"
+#include "base/macros.h"
+#include "base/string_piece.h"
+
+namespace cobra {
+
+// A chunk of bytes, either allocated by us and appendable, or borrowed
+// from the caller and read only. A borrowed block hands its memory back
+// through the release callback once the last reference is gone, which
+// lets the caller send it without a copy, @see TcpConnection::send.
+class Block {
+ public:
+  typedef boost::function<void ()> ReleaseCb;
+
+  static const size_t kDefaultCapacity = 16 * 1024;
+
+  // An empty block of our own.
+  explicit Block(size_t capacity = kDefaultCapacity);
+
+  // Borrows [data, data + len), 'release' may be empty.
+  Block(const void* data, size_t len, const ReleaseCb& release);
+
+  ~Block();
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool owned() const { return owned_; }
+
+  size_t writableBytes() const {
+    return owned_ ? capacity_ - size_ : 0;
+  }
+
+  char* BeginWrite() {
+    assert(owned_);
+    return data_ + size_;
+  }
+
+  void hasWritten(size_t len) {
+    assert(len <= writableBytes());
+    size_ += len;
+  }
+
+  void append(const void* data, size_t len) {
+    assert(len <= writableBytes());
+    ::memcpy(BeginWrite(), data, len);
+    hasWritten(len);
+  }
+
+  // Forgets the content, only for blocks of our own.
+  void clear() {
+    assert(owned_);
+    size_ = 0;
+  }
+
+ private:
+  char* data_;
+  size_t size_;
+  size_t capacity_;
+  bool owned_;
+  ReleaseCb release_;
+
+  DISABLE_COPY_AND_ASSIGN(Block);
+};
+
+typedef boost::shared_ptr<Block> BlockPtr;
+
+// A queue of byte ranges in blocks, flushed with writev(2).
+//
+// Copied bytes go to fixed-size blocks of our own, filling the last one
+// before allocating the next, so a large backlog never gets moved around
+// like in a contiguous Buffer. Blocks appended by reference are queued
+// as they are, and file regions are sent by the kernel with sendfile(2).
+//
+// Large batches may be sent with MSG_ZEROCOPY, the kernel then reads the
+// blocks after the call returns, so they are pinned (referenced) until
+// it tells it's done with them, @see zeroCopyCompleted.
+class BlockChain {
+ public:
+  // The most segments given to one writev(2).
+  static const int kMaxIovecs = 64;
+
+  BlockChain();
+  ~BlockChain();
+
+  size_t readableBytes() const { return readable_; }
+  bool empty() const { return readable_ == 0; }
+
+  // Copies the bytes.
+  void append(const StringPiece& str) {
+    append(str.data(), str.size());
+  }
+  void append(const void* data, size_t len);
+
+  // Queues (part of) the block itself, no copy.
+  void append(const BlockPtr& block) {
+    append(block, 0, block->size());
+  }
+  void append(const BlockPtr& block, size_t offset, size_t len);
+
+  // Queues 'len' bytes of the file from 'offset', the chain owns 'fd'
+  // and closes it once sent or dropped.
+  void appendFile(int fd, off_t offset, size_t len);
+
+  void retrieve(size_t len);
+  void retrieveAll();
+
+  // Writes as much as one writev(2) (or sendfile(2) if a file region is
+  // first) takes, and retrieves it.
+  // @return result of the syscall, @c errno is saved. A file shorter
+  // than queued fails with EIO.
+  ssize_t writeFd(int fd, int* savedErrno);
+
+  // A file region is first, only writeFd sends it.
+  bool fileFirst() const {
+    return !segments_.empty() && segments_.front().fd >= 0;
+  }
+
+  // Fills 'vec' with the blocks up to the next file region, for sending
+  // them some other way, then retrieve what went out.
+  // @return the number of iovecs, at most 'maxIovecs'
+  int peek(iovec* vec, int maxIovecs) const;
+
+  // Sends batches of at least 'threshold' bytes with MSG_ZEROCOPY,
+  // 0 disables it. The socket must have SO_ZEROCOPY set.
+  void setZeroCopyThreshold(size_t threshold) {
+    zeroCopyThreshold_ = threshold;
+  }
+
+  // Unpins the blocks of the zerocopy sends numbered [lo, hi],
+  // @see RecvZeroCopyCompletion.
+  void zeroCopyCompleted(uint32 lo, uint32 hi);
+
+  size_t pinnedBlocks() const { return pins_.size(); }
+
+  // Moves the pins of 'other' here, to keep its blocks past it,
+  // @see ZeroCopyLinger.
+  void takePins(BlockChain* other);
+
+ private:
+  // Drained blocks kept for reuse.
+  static const size_t kMaxSpareBlocks = 2;
+
+  // Either a range of a block, or a file region if 'fd' >= 0.
+  struct Segment {
+    BlockPtr block;
+    const char* begin;
+    size_t len;
+    // One of our blocks, and this segment ends at its write end.
+    bool appendable;
+    int fd;
+    off_t offset;
+  };
+
+  // A block the kernel may still read, for the zerocopy send 'seq'.
+  struct Pin {
+    uint32 seq;
+    BlockPtr block;
+  };
+
+  BlockPtr newBlock();
+  void popFront();
+  ssize_t sendFileFront(int fd, int* savedErrno);
+  // Pins the blocks of the first 'len' bytes.
+  void pin(size_t len);
+
+  std::deque<Segment> segments_;
+  size_t readable_;
+  std::vector<BlockPtr> spares_;
+
+  size_t zeroCopyThreshold_;
+  // The number of the next zerocopy send, counted like the kernel does.
+  uint32 zeroCopySeq_;
+  std::deque<Pin> pins_;
+
+  DISABLE_COPY_AND_ASSIGN(BlockChain);
+};
+
+}  // namespace cobra
+
+#endif  // COBRA_BLOCK_CHAIN_H_
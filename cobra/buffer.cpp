@@ -44,4 +44,17 @@ ssize_t Buffer::readFd(int fd, int* savedErrno) {
   return n;
 }
 
+ssize_t Buffer::readFd(int fd, size_t len, int* savedErrno) {
+  // Read in place, whatever doesn't fit waits for the next read.
+  ensureWritableBytes(len);
+  const ssize_t n = cobra::read(fd, BeginWrite(), len);
+  if (n < 0) {
+    *savedErrno = errno;
+  } else {
+    hasWritten(implicit_cast<size_t>(n));
+  }
+
+  return n;
+}
+
 }  // namespace cobra
@@ -11,6 +11,7 @@
 #include <algorithm>
 #include <vector>
 
+#include "cobra/delimiter_scan.h"
 #include "cobra/endian.h"
 
 namespace cobra {
@@ -33,7 +34,8 @@ class Buffer {
   Buffer()
     : buffer_(kCheapPrepend + kInitialSize),
       readerIndex_(kCheapPrepend),
-      writerIndex_(kCheapPrepend) {
+      writerIndex_(kCheapPrepend),
+      scanned_(0) {
     assert(readableBytes() == 0);
     assert(writableBytes() == kInitialSize);
     assert(prependableBytes() == kCheapPrepend);
@@ -43,6 +45,7 @@ class Buffer {
     buffer_.swap(rhs.buffer_);
     std::swap(readerIndex_, rhs.readerIndex_);
     std::swap(writerIndex_, rhs.writerIndex_);
+    std::swap(scanned_, rhs.scanned_);
   }
 
   inline size_t readableBytes() const {
@@ -62,29 +65,45 @@ class Buffer {
     return begin() + readerIndex_;
   }
 
-  // Find the "\r\n" symbol.
+  // Find the "\r\n" symbol, @see cobra::findCRLF.
   const char* findCRLF() const {
-    const char* crlf = std::search(BeginRead(), BeginWrite(), kCRLF, kCRLF+2);
-    return crlf == BeginWrite() ? NULL : crlf;
+    return cobra::findCRLF(BeginRead(), BeginWrite());
   }
 
   const char* findCRLF(const char* start) const {
     assert(BeginRead() <= start);
     assert(start <= BeginWrite());
-    const char* crlf = std::search(start, BeginWrite(), kCRLF, kCRLF+2);
-    return crlf == BeginWrite() ? NULL : crlf;
+    return cobra::findCRLF(start, BeginWrite());
   }
 
   const char* findEOL() const {
-    const void* eol = memchr(BeginRead(), '\n', readableBytes());
-    return static_cast<const char*>(eol);
+    return findByte(BeginRead(), BeginWrite(), kEOL);
   }
 
   const char* findEOL(const char* start) const {
     assert(BeginRead() <= start);
     assert(start <= BeginWrite());
-    const void* eol = memchr(start, '\n', readableBytes());
-    return static_cast<const char*>(eol);
+    return findByte(start, BeginWrite(), kEOL);
+  }
+
+  // The first 'delimiter' from 'start', NULL if none.
+  const char* find(const char* start, char delimiter) const {
+    assert(BeginRead() <= start);
+    assert(start <= BeginWrite());
+    return findByte(start, BeginWrite(), delimiter);
+  }
+
+  // How many readable bytes a parser already searched, without finding
+  // what it looks for, so that it resumes there once more bytes came in
+  // instead of rescanning from the start, @see LineCodec.
+  // Retrieving bytes takes them off, prepending resets it.
+  size_t scannedBytes() const {
+    return scanned_;
+  }
+
+  void setScannedBytes(size_t len) {
+    assert(len <= readableBytes());
+    scanned_ = len;
   }
 
   // retrieve returns void, to prevent
@@ -94,6 +113,7 @@ class Buffer {
     assert(len <= readableBytes());
     if (len < readableBytes()) {
       readerIndex_ += len;
+      scanned_ = scanned_ > len ? scanned_ - len : 0;
     } else {
       retrieveAll();
     }
@@ -120,6 +140,7 @@ class Buffer {
   void retrieveAll() {
     readerIndex_ = kCheapPrepend;
     writerIndex_ = kCheapPrepend;
+    scanned_ = 0;
   }
 
   string retrieveAllAsString() {
@@ -257,6 +278,7 @@ class Buffer {
   void prepend(const void* /*restrict*/ data, size_t len) {
     assert(len <= prependableBytes());
     readerIndex_ -= len;
+    scanned_ = 0;
     const char* d = static_cast<const char*>(data);
     std::copy(d, d+len, begin() + readerIndex_);
   }
@@ -275,10 +297,16 @@ class Buffer {
 
   /// Read data directly into buffer.
   ///
-  /// It may implement with readv(2)
+  /// One readv(2), what doesn't fit goes through a 64k stack buffer and
+  /// is appended, so it may grow the buffer by that much.
   /// @return result of read(2), @c errno is saved
   ssize_t readFd(int fd, int* savedErrno);
 
+  /// Read at most 'len' bytes directly into buffer, after making room
+  /// for them, @see ReadSizer.
+  /// @return result of read(2), @c errno is saved
+  ssize_t readFd(int fd, size_t len, int* savedErrno);
+
  private:
   char* begin() {
     return &*buffer_.begin();
@@ -309,6 +337,8 @@ class Buffer {
   std::vector<char> buffer_;
   size_t readerIndex_;
   size_t writerIndex_;
+  // @see scannedBytes
+  size_t scanned_;
 
   // "\r\n": Carriage-Return(\r, means "return") Line-Feed(\n, means "new line")
   static const char kCRLF[];
@@ -32,6 +32,7 @@ typedef boost::function<void (const TcpConnectionPtr&)> ConnectionCb;
 typedef boost::function<void (const TcpConnectionPtr&)> CloseCb;
 typedef boost::function<void (const TcpConnectionPtr&)> WriteCompleteCb;
 typedef boost::function<void (const TcpConnectionPtr&, size_t)> HighWaterMarkCb;
+typedef boost::function<void (const TcpConnectionPtr&)> ResumeReadCb;
 
 // the data has been read to (buf, len)
 typedef boost::function<void (const TcpConnectionPtr&,
@@ -19,8 +19,14 @@ Channel::Channel(Worker* loop, int fd)
     revents_(0),
     index_(-1),
     logHup_(true),
+    edgeTriggered_(false),
     tied_(false),
-    eventHandling_(false) {
+    eventHandling_(false),
+    recvDone_(false),
+    recvData_(NULL),
+    recvResult_(0),
+    sendDone_(false),
+    sendResult_(0) {
 }
 
 Channel::~Channel() {
@@ -74,15 +80,31 @@ void Channel::handleEventWithGuard(Timestamp receiveTime) {
     // @see TcpConnection::handleError if the wrapped fd is a conn socket
     errorCb_();
   }
-  if ((revents_ & (POLLIN | POLLPRI | POLLRDHUP)) && readCb_) {
+  // In edge-triggered mode the poller reports every event registered,
+  // not only the ones we are currently interested in.
+  if ((revents_ & (POLLIN | POLLPRI | POLLRDHUP)) && readCb_ &&
+      (!edgeTriggered_ || isReading())) {
     // @see TcpConnection::handleRead if the wrapped fd is a conn socket
     readCb_(receiveTime);
   }
-  if ((revents_ & POLLOUT) && writeCb_) {
+  if ((revents_ & POLLOUT) && writeCb_ &&
+      (!edgeTriggered_ || isWriting())) {
     // @see TcpConnection::handleWrite if the wrapped fd is a conn socket
     writeCb_();
   }
 
+  // Completions after the events, a close reported by them goes first.
+  if (recvDone_) {
+    recvDone_ = false;
+    // @see TcpConnection::handleRecvDone if the wrapped fd is a conn socket
+    recvDoneCb_(recvData_, recvResult_, receiveTime);
+  }
+  if (sendDone_) {
+    sendDone_ = false;
+    // @see TcpConnection::handleSendDone if the wrapped fd is a conn socket
+    sendDoneCb_(sendResult_);
+  }
+
   eventHandling_ = false;
 }
 
@@ -5,6 +5,9 @@
 #ifndef COBRA_CHANNEL_H_
 #define COBRA_CHANNEL_H_
 
+#include <assert.h>
+#include <sys/types.h>
+
 #include <boost/function.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
@@ -24,6 +27,10 @@ class Channel {
  public:
   typedef boost::function<void()> EventCb;
   typedef boost::function<void(Timestamp)> ReadEventCb;
+  typedef boost::function<void(const char* data,
+                               ssize_t n,
+                               Timestamp)> RecvDoneCb;
+  typedef boost::function<void(ssize_t n)> SendDoneCb;
 
   Channel(Worker* loop, int fd);
   ~Channel();
@@ -51,6 +58,22 @@ class Channel {
     errorCb_ = cb;
   }
 
+  // Completion-based I/O, only honored by pollers supporting it,
+  // @see Poller::completionIo.
+  //
+  // While reading is enabled, the poller receives from the fd itself and
+  // calls this with what it got, 0 on end of file or -errno, instead of
+  // reporting the fd readable. 'data' lives until the callback returns.
+  // A receive may still complete once reading is disabled.
+  void SetRecvDoneCb(const RecvDoneCb& cb) {
+    recvDoneCb_ = cb;
+  }
+  // Called with the result of Poller::submitSend, bytes sent or -errno.
+  void SetSendDoneCb(const SendDoneCb& cb) {
+    sendDoneCb_ = cb;
+  }
+  bool completionReads() const { return !recvDoneCb_.empty(); }
+
   // Tie this channel to the owner object managed by shared_ptr,
   // prevent the owner object being destroyed in handleEvent.
   void tie(const boost::shared_ptr<void>&);
@@ -58,6 +81,16 @@ class Channel {
   int fd() const { return fd_; }
   int events() const { return events_; }
   void set_revents(int revt) { revents_ = revt; } // used by pollers
+  // Completions, used by pollers, handled with the events.
+  void set_recvDone(const char* data, ssize_t n) {
+    recvData_ = data;
+    recvResult_ = n;
+    recvDone_ = true;
+  }
+  void set_sendDone(ssize_t n) {
+    sendResult_ = n;
+    sendDone_ = true;
+  }
   // int revents() const { return revents_; }
   bool isNoneEvent() const { return events_ == kNoneEvent; }
 
@@ -69,7 +102,12 @@ class Channel {
     update();
   }
 
-  // void disableReading() { events_ &= ~kReadEvent; update(); }
+
+  void disableReading() {
+    events_ &= ~kReadEvent;
+    update();
+  }
+
   void enableWriting() {
     events_ |= kWriteEvent;
     update();
@@ -86,6 +124,20 @@ class Channel {
   }
 
   bool isWriting() const { return events_ & kWriteEvent; }
+  bool isReading() const { return events_ & kReadEvent; }
+
+  // Edge-triggered mode, only honored by EPollPoller.
+  //
+  // The fd is then registered once for both reading and writing, and
+  // enabling/disabling writing doesn't touch the poller any more. The
+  // owner must read/write until EAGAIN, or it won't be notified again.
+  // Must be set before the channel is first updated.
+  void setEdgeTriggered(bool on) {
+    assert(index_ < 0);
+    edgeTriggered_ = on;
+  }
+
+  bool edgeTriggered() const { return edgeTriggered_; }
 
   // Only for Poller
   int index() { return index_; }
@@ -124,15 +176,25 @@ class Channel {
 
   int index_; // used by Poller.
   bool logHup_;
+  bool edgeTriggered_;
 
   boost::weak_ptr<void> tie_;
   bool tied_;
   bool eventHandling_;
 
+  // Completions to hand over, @see SetRecvDoneCb.
+  bool recvDone_;
+  const char* recvData_;
+  ssize_t recvResult_;
+  bool sendDone_;
+  ssize_t sendResult_;
+
   ReadEventCb readCb_;
   EventCb writeCb_;
   EventCb closeCb_;
   EventCb errorCb_;
+  RecvDoneCb recvDoneCb_;
+  SendDoneCb sendDoneCb_;
 
   DISABLE_COPY_AND_ASSIGN(Channel);
 };
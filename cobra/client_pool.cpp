@@ -0,0 +1,205 @@
+#include "cobra/client_pool.h"
+
+#include <cstdio>
+
+#include <boost/bind.hpp>
+
+#include "base/CountDownLatch.h"
+#include "base/Logging.h"
+#include "cobra/connector.h"
+#include "cobra/worker.h"
+
+namespace cobra {
+
+const int ClientPool::kDefaultMaxPipeline;
+
+ClientPool::ClientPool(const std::vector<Worker*>& loops,
+                       const Endpoint& serverAddr,
+                       const string& name,
+                       int connections)
+  : loops_(loops),
+    serverAddr_(serverAddr),
+    name_(name),
+    numConnections_(connections),
+    maxPipeline_(kDefaultMaxPipeline),
+    maxInFlight_(0),
+    connectTimeout_(Connector::kDefaultConnectTimeoutMs / 1000.0),
+    autoCork_(false),
+    started_(false) {
+  assert(!loops_.empty());
+  assert(numConnections_ > 0);
+}
+
+ClientPool::~ClientPool() {
+  LOG_TRACE << "ClientPool::~ClientPool [" << name_ << "] dying";
+  // The clients and connections must go in their own loop.
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    CountDownLatch latch(1);
+    slots_[i].loop->runInLoop(
+        boost::bind(&ClientPool::destroyInLoop, this, &slots_[i], &latch));
+    latch.wait();
+  }
+}
+
+void ClientPool::start() {
+  if (started_) {
+    return;
+  }
+  assert(responseLengthCb_);
+  assert(maxPipeline_ > 0);
+
+  for (int i = 0; i < numConnections_; ++i) {
+    char buf[32];
+    snprintf(buf, sizeof buf, "#%d", i);
+    Slot* slot = new Slot;
+    slot->loop = loops_[i % loops_.size()];
+    slot->client.reset(new TcpClient(slot->loop, serverAddr_, name_ + buf));
+    slot->client->setConnectionCb(
+        boost::bind(&ClientPool::onConnection, this, slot, _1));
+    slot->client->setMessageCb(
+        boost::bind(&ClientPool::onMessage, this, slot, _1, _2, _3));
+    slot->client->setConnectTimeout(connectTimeout_);
+    slot->client->enableRetry();
+    slots_.push_back(slot);
+  }
+
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    slots_[i].client->connect();
+  }
+  started_ = true;
+}
+
+bool ClientPool::call(const StringPiece& request, const ResponseCb& cb) {
+  const int32 inFlight = inFlight_.incrementAndGet();
+  Slot* slot = NULL;
+  if (maxInFlight_ <= 0 || inFlight <= maxInFlight_) {
+    slot = checkout();
+  }
+  if (slot == NULL) {
+    inFlight_.decrement();
+    rejected_.increment();
+    return false;
+  }
+
+  // The callback must be queued in the order the request is sent, both
+  // happen in the loop.
+  slot->loop->runInLoop(
+      boost::bind(&ClientPool::sendInLoop, this, slot,
+                  request.as_string(), cb));
+  return true;
+}
+
+ClientPool::Slot* ClientPool::checkout() {
+  const uint32 n = static_cast<uint32>(slots_.size());
+  const uint32 start = static_cast<uint32>(next_.getAndAdd(1));
+  for (uint32 i = 0; i < n; ++i) {
+    Slot* slot = &slots_[(start + i) % n];
+    if (slot->connected.get() == 0) {
+      continue;
+    }
+    if (slot->outstanding.incrementAndGet() <= maxPipeline_) {
+      return slot;
+    }
+    slot->outstanding.decrement();
+  }
+  return NULL;
+}
+
+void ClientPool::release(Slot* slot) {
+  slot->outstanding.decrement();
+  inFlight_.decrement();
+}
+
+void ClientPool::sendInLoop(Slot* slot,
+                            const string& request,
+                            const ResponseCb& cb) {
+  slot->loop->assertInLoopThread();
+  if (!slot->conn || !slot->conn->connected()) {
+    // Lost since checked out.
+    release(slot);
+    cb(false, StringPiece());
+    return;
+  }
+  slot->pending.push_back(cb);
+  slot->conn->send(request);
+}
+
+void ClientPool::onConnection(Slot* slot, const TcpConnectionPtr& conn) {
+  slot->loop->assertInLoopThread();
+  LOG_INFO << "ClientPool [" << name_ << "] - " << conn->name() << " is "
+           << (conn->connected() ? "UP" : "DOWN");
+  if (conn->connected()) {
+    conn->setTcpNoDelay(true);
+    conn->setAutoCork(autoCork_);
+    slot->conn = conn;
+    slot->connected.getAndSet(1);
+  } else {
+    slot->connected.getAndSet(0);
+    slot->conn.reset();
+    failPending(slot);
+  }
+}
+
+void ClientPool::onMessage(Slot* slot,
+                           const TcpConnectionPtr& conn,
+                           Buffer* buffer,
+                           Timestamp /*receiveTime*/) {
+  slot->loop->assertInLoopThread();
+  while (buffer->readableBytes() > 0) {
+    const size_t len = responseLengthCb_(buffer);
+    if (len == 0) {
+      break;
+    }
+    assert(len <= buffer->readableBytes());
+    if (slot->pending.empty()) {
+      LOG_ERROR << "ClientPool [" << name_ << "] - " << conn->name()
+                << " unexpected response, closing";
+      buffer->retrieveAll();
+      conn->forceClose();
+      return;
+    }
+
+    ResponseCb cb;
+    cb.swap(slot->pending.front());
+    slot->pending.pop_front();
+    release(slot);
+    cb(true, StringPiece(buffer->BeginRead(), static_cast<int>(len)));
+    buffer->retrieve(len);
+  }
+}
+
+void ClientPool::failPending(Slot* slot) {
+  std::deque<ResponseCb> pending;
+  pending.swap(slot->pending);
+  for (size_t i = 0; i < pending.size(); ++i) {
+    release(slot);
+    pending[i](false, StringPiece());
+  }
+}
+
+void ClientPool::destroyInLoop(Slot* slot, CountDownLatch* latch) {
+  slot->connected.getAndSet(0);
+  TcpConnectionPtr conn;
+  conn.swap(slot->conn);
+  if (conn) {
+    // We are gone before the connection.
+    conn->SetConnectionCb(defaultConnectionCb);
+    conn->SetMessageCb(defaultMessageCb);
+  }
+  failPending(slot);
+  slot->client.reset();
+  if (conn) {
+    conn->forceClose();
+  }
+  latch->countDown();
+}
+
+int32 ClientPool::connectedCount() {
+  int32 n = 0;
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    n += slots_[i].connected.get();
+  }
+  return n;
+}
+
+}  // namespace cobra
@@ -0,0 +1,164 @@
+// Author: Jianbo Zhu
+//
+// A pool of warm client connections to one backend, with pipelined
+// requests.
+
+#ifndef COBRA_CLIENT_POOL_H_
+#define COBRA_CLIENT_POOL_H_
+
+#include <deque>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "base/Atomic.h"
+#include "base/basic_types.h"
+#include "base/macros.h"
+#include "base/string_piece.h"
+#include "cobra/endpoint.h"
+#include "cobra/tcp_client.h"
+
+namespace cobra {
+
+class CountDownLatch;
+
+// Keeps a fixed number of connections to one backend, spread over the
+// given loops, and reconnects the ones lost.
+//
+// Requests are pipelined: a connection carries up to a number of
+// outstanding requests, whose responses come back in order. The pool
+// tells responses apart with the response length callback, so it works
+// with any protocol that answers each request with one framed response.
+//
+// Checking a connection out only touches atomic counters, the
+// connections themselves are only handled in their loops. The requests
+// in flight are bounded per connection and for the whole backend, call()
+// rejects the ones above.
+class ClientPool {
+ public:
+  static const int kDefaultMaxPipeline = 16;
+
+  // Length of the complete response at the front of 'buffer', 0 if it
+  // didn't fully arrive yet.
+  typedef boost::function<size_t (const Buffer* buffer)> ResponseLengthCb;
+  // 'ok' is false, and 'response' empty, if the connection was lost
+  // before the response came. 'response' lives until the callback
+  // returns.
+  typedef boost::function<void (bool ok,
+                                const StringPiece& response)> ResponseCb;
+
+  // 'connections' connections, the i-th one in loops[i % loops.size()].
+  ClientPool(const std::vector<Worker*>& loops,
+             const Endpoint& serverAddr,
+             const string& name,
+             int connections);
+  // The loops must still be running, and call() no longer be called.
+  ~ClientPool();
+
+  // Must be called before @c start.
+  void setResponseLengthCb(const ResponseLengthCb& cb) {
+    responseLengthCb_ = cb;
+  }
+
+  // The most requests waiting for a response on one connection,
+  // kDefaultMaxPipeline by default, 1 disables pipelining.
+  // Must be called before @c start.
+  void setMaxPipeline(int n) { maxPipeline_ = n; }
+
+  // The most requests waiting for a response on the whole pool, 0 (the
+  // default) for no other bound than the pipelines.
+  // Must be called before @c start.
+  void setMaxInFlight(int n) { maxInFlight_ = n; }
+
+  // @see Connector::setConnectTimeout.
+  // Must be called before @c start.
+  void setConnectTimeout(double seconds) { connectTimeout_ = seconds; }
+
+  // Gathers the requests sent in one loop iteration,
+  // @see TcpConnection::setAutoCork.
+  // Must be called before @c start.
+  void setAutoCork(bool on) { autoCork_ = on; }
+
+  // Connects all the connections.
+  void start();
+
+  // Sends 'request' on a connected connection with room in its
+  // pipeline, 'cb' then runs in the loop of that connection.
+  // Thread safe.
+  // @return false if no connection is up or the pool is full, 'cb' is
+  // not called then.
+  bool call(const StringPiece& request, const ResponseCb& cb);
+
+  const string& name() const { return name_; }
+
+  ////////////////////// begin /////////////////////////////////
+  // Thread safe.
+
+  // The connections up.
+  int32 connectedCount();
+  // The requests waiting for a response.
+  int32 inFlight() { return inFlight_.get(); }
+  // The calls rejected, @see call.
+  int64 rejectedCalls() { return rejected_.get(); }
+  ///////////////////////// end ///////////////////////////////
+
+ private:
+  // One connection of the pool.
+  struct Slot {
+    Worker* loop;
+    boost::scoped_ptr<TcpClient> client;
+    // 1 when up, set in the loop, read by call().
+    AtomicInt32 connected;
+    // The requests checked out on this connection.
+    AtomicInt32 outstanding;
+
+    // Only in the loop.
+    TcpConnectionPtr conn;
+    // The callbacks of the requests sent, in order.
+    std::deque<ResponseCb> pending;
+  };
+
+  // Reserves room for a request on a connection, round-robin over the
+  // connections up with room in their pipeline.
+  // @return NULL if there's none
+  Slot* checkout();
+  // Gives back what checkout and call reserved.
+  void release(Slot* slot);
+
+  // In the loop of 'slot'.
+  void sendInLoop(Slot* slot, const string& request, const ResponseCb& cb);
+  void onConnection(Slot* slot, const TcpConnectionPtr& conn);
+  void onMessage(Slot* slot,
+                 const TcpConnectionPtr& conn,
+                 Buffer* buffer,
+                 Timestamp receiveTime);
+  // Fails the requests waiting on 'slot'.
+  void failPending(Slot* slot);
+  // On destruction.
+  void destroyInLoop(Slot* slot, CountDownLatch* latch);
+
+  const std::vector<Worker*> loops_;
+  const Endpoint serverAddr_;
+  const string name_;
+  const int numConnections_;
+  ResponseLengthCb responseLengthCb_;
+  int maxPipeline_;
+  int maxInFlight_;
+  double connectTimeout_;
+  bool autoCork_;
+  bool started_;
+  boost::ptr_vector<Slot> slots_;
+
+  // Where checkout starts looking.
+  AtomicInt32 next_;
+  AtomicInt32 inFlight_;
+  AtomicInt64 rejected_;
+
+  DISABLE_COPY_AND_ASSIGN(ClientPool);
+};
+
+}  // namespace cobra
+
+#endif  // COBRA_CLIENT_POOL_H_
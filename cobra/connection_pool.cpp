@@ -0,0 +1,116 @@
+#include "cobra/connection_pool.h"
+
+#include "cobra/buffer.h"
+
+namespace cobra {
+
+const size_t ConnectionPool::kMaxFreeBlocks;
+const size_t ConnectionPool::kMaxFreeBuffers;
+const size_t ConnectionPool::kMaxBufferCapacity;
+const size_t ConnectionPool::kMaxFreeBufferBytes;
+
+ConnectionPool::ConnectionPool()
+  : closed_(false),
+    freeBufferBytes_(0) {
+}
+
+ConnectionPool::~ConnectionPool() {
+  close();
+}
+
+void ConnectionPool::close() {
+  std::vector<FreeList> freeLists;
+  std::vector<Buffer*> freeBuffers;
+  {
+    MutexLockGuard lock(mutex_);
+    closed_ = true;
+    freeLists.swap(freeLists_);
+    freeBuffers.swap(freeBuffers_);
+    freeBufferBytes_ = 0;
+  }
+  for (size_t i = 0; i < freeLists.size(); ++i) {
+    std::vector<void*>& blocks = freeLists[i].blocks;
+    for (size_t j = 0; j < blocks.size(); ++j) {
+      ::operator delete(blocks[j]);
+    }
+  }
+  for (size_t i = 0; i < freeBuffers.size(); ++i) {
+    delete freeBuffers[i];
+  }
+}
+
+ConnectionPool::FreeList* ConnectionPool::freeListOf(size_t size) {
+  for (size_t i = 0; i < freeLists_.size(); ++i) {
+    if (freeLists_[i].size == size) {
+      return &freeLists_[i];
+    }
+  }
+  return NULL;
+}
+
+void* ConnectionPool::allocate(size_t size) {
+  {
+    MutexLockGuard lock(mutex_);
+    FreeList* freeList = freeListOf(size);
+    if (freeList != NULL && !freeList->blocks.empty()) {
+      void* p = freeList->blocks.back();
+      freeList->blocks.pop_back();
+      allocHits_.increment();
+      return p;
+    }
+  }
+  allocMisses_.increment();
+  return ::operator new(size);
+}
+
+void ConnectionPool::deallocate(void* p, size_t size) {
+  {
+    MutexLockGuard lock(mutex_);
+    FreeList* freeList = freeListOf(size);
+    if (freeList == NULL && !closed_) {
+      freeLists_.push_back(FreeList());
+      freeList = &freeLists_.back();
+      freeList->size = size;
+    }
+    if (freeList != NULL && freeList->blocks.size() < kMaxFreeBlocks) {
+      freeList->blocks.push_back(p);
+      return;
+    }
+  }
+  ::operator delete(p);
+}
+
+Buffer* ConnectionPool::takeBuffer() {
+  {
+    MutexLockGuard lock(mutex_);
+    if (!freeBuffers_.empty()) {
+      Buffer* buf = freeBuffers_.back();
+      freeBuffers_.pop_back();
+      freeBufferBytes_ -= buf->internalCapacity();
+      bufferHits_.increment();
+      return buf;
+    }
+  }
+  bufferMisses_.increment();
+  return new Buffer;
+}
+
+void ConnectionPool::giveBuffer(Buffer* buf) {
+  const size_t capacity = buf->internalCapacity();
+  if (capacity <= kMaxBufferCapacity) {
+    buf->retrieveAll();
+    MutexLockGuard lock(mutex_);
+    // By count and by bytes, or 4096 buffers grown to 64K would keep
+    // 256M per loop.
+    if (!closed_ &&
+        freeBuffers_.size() < kMaxFreeBuffers &&
+        freeBufferBytes_ + capacity <= kMaxFreeBufferBytes) {
+      freeBuffers_.push_back(buf);
+      freeBufferBytes_ += capacity;
+      return;
+    }
+  }
+  delete buf;
+}
+
+}  // namespace cobra
@@ -0,0 +1,165 @@
+// Author: Jianbo Zhu
+//
+// Recycled storage for the connections of a loop.
+
+#ifndef COBRA_CONNECTION_POOL_H_
+#define COBRA_CONNECTION_POOL_H_
+
+#include <stddef.h>
+
+#include <new>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "base/Atomic.h"
+#include "base/basic_types.h"
+#include "base/macros.h"
+#include "base/Mutex.h"
+
+namespace cobra {
+
+class Buffer;
+
+// Keeps the memory of the connections gone, for the next ones: the
+// block holding a TcpConnection with its shared_ptr control block (and
+// its Channel), @see ConnectionPoolAllocator, and the input buffers.
+// Short-lived connections then allocate nothing once the pool is warm.
+//
+// Shared by the Worker serving the connections and the connections
+// themselves, which may outlive it when a user keeps one. The Worker
+// closes it on its way out, what comes back later goes straight to the
+// system. Thread safe, since they are created in the accepting loop and
+// may die in any thread.
+class ConnectionPool {
+ public:
+  ConnectionPool();
+  ~ConnectionPool();
+
+  // Frees what is kept, and keeps nothing from now on.
+  void close();
+
+  // Memory for 'size' bytes.
+  void* allocate(size_t size);
+  void deallocate(void* p, size_t size);
+
+  // An empty buffer.
+  Buffer* takeBuffer();
+  // Keeps 'buf' for takeBuffer, unless it grew too large.
+  void giveBuffer(Buffer* buf);
+
+  ////////////////////// begin /////////////////////////////////
+  // pool statistics, the hit rate is hits / (hits + misses).
+
+  int64 allocHits() { return allocHits_.get(); }
+  int64 allocMisses() { return allocMisses_.get(); }
+  int64 bufferHits() { return bufferHits_.get(); }
+  int64 bufferMisses() { return bufferMisses_.get(); }
+  ///////////////////////// end ///////////////////////////////
+
+ private:
+  // Kept per block size.
+  static const size_t kMaxFreeBlocks = 4096;
+  static const size_t kMaxFreeBuffers = 4096;
+  // Larger input buffers are given back to the system.
+  static const size_t kMaxBufferCapacity = 64 * 1024;
+  // The most memory the free buffers may hold: room for all of them at
+  // the initial size, not for many grown ones.
+  static const size_t kMaxFreeBufferBytes = 8 * 1024 * 1024;
+
+  struct FreeList {
+    size_t size;
+    std::vector<void*> blocks;
+  };
+
+  // Must hold 'mutex_', @c NULL if there is none.
+  FreeList* freeListOf(size_t size);
+
+  MutexLock mutex_;
+  bool closed_;
+  // A size or two in practice.
+  std::vector<FreeList> freeLists_;
+  std::vector<Buffer*> freeBuffers_;
+  // The capacity of 'freeBuffers_'.
+  size_t freeBufferBytes_;
+
+  AtomicInt64 allocHits_;
+  AtomicInt64 allocMisses_;
+  AtomicInt64 bufferHits_;
+  AtomicInt64 bufferMisses_;
+
+  DISABLE_COPY_AND_ASSIGN(ConnectionPool);
+};
+
+typedef boost::shared_ptr<ConnectionPool> ConnectionPoolPtr;
+
+// A standard allocator drawing from a ConnectionPool, for
+// boost::allocate_shared. The copy kept in the control block holds the
+// pool until the connection is freed.
+template <typename T>
+class ConnectionPoolAllocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template <typename U>
+  struct rebind {
+    typedef ConnectionPoolAllocator<U> other;
+  };
+
+  explicit ConnectionPoolAllocator(const ConnectionPoolPtr& pool)
+    : pool_(pool) {
+  }
+
+  template <typename U>
+  ConnectionPoolAllocator(const ConnectionPoolAllocator<U>& other)
+    : pool_(other.pool()) {
+  }
+
+  const ConnectionPoolPtr& pool() const { return pool_; }
+
+  pointer address(reference x) const { return &x; }
+  const_pointer address(const_reference x) const { return &x; }
+
+  pointer allocate(size_type n, const void* = 0) {
+    return static_cast<pointer>(pool_->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(pointer p, size_type n) {
+    pool_->deallocate(p, n * sizeof(T));
+  }
+
+  size_type max_size() const {
+    return static_cast<size_type>(-1) / sizeof(T);
+  }
+
+  void construct(pointer p, const T& value) {
+    new (p) T(value);
+  }
+
+  void destroy(pointer p) {
+    p->~T();
+  }
+
+  template <typename U>
+  bool operator==(const ConnectionPoolAllocator<U>& other) const {
+    return pool_ == other.pool();
+  }
+
+  template <typename U>
+  bool operator!=(const ConnectionPoolAllocator<U>& other) const {
+    return pool_ != other.pool();
+  }
+
+ private:
+  ConnectionPoolPtr pool_;
+};
+
+}  // namespace cobra
+
+#endif  // COBRA_CONNECTION_POOL_H_
@@ -0,0 +1,115 @@
+#include "cobra/connection_table.h"
+
+#include <assert.h>
+
+namespace cobra {
+
+const size_t ConnectionTable::kInitialCapacity;
+
+ConnectionTable::ConnectionTable()
+  : entries_(kInitialCapacity),
+    mask_(kInitialCapacity - 1),
+    size_(0) {
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    entries_[i].id = 0;
+  }
+}
+
+ConnectionTable::~ConnectionTable() {
+}
+
+size_t ConnectionTable::probe(uint64 id) const {
+  size_t i = bucketOf(id);
+  while (entries_[i].id != 0 && entries_[i].id != id) {
+    i = (i + 1) & mask_;
+  }
+  return i;
+}
+
+void ConnectionTable::insert(uint64 id, const TcpConnectionPtr& conn) {
+  assert(id != 0);
+  // Keep it at most half full, probes stay short.
+  if ((size_ + 1) * 2 > entries_.size()) {
+    grow();
+  }
+
+  size_t i = probe(id);
+  assert(entries_[i].id == 0);
+  entries_[i].id = id;
+  entries_[i].conn = conn;
+  ++size_;
+}
+
+bool ConnectionTable::erase(uint64 id) {
+  size_t i = probe(id);
+  if (entries_[i].id == 0) {
+    return false;
+  }
+
+  // Shift back the entries of the cluster which would no longer be
+  // found past the hole.
+  size_t j = i;
+  for (;;) {
+    j = (j + 1) & mask_;
+    if (entries_[j].id == 0) {
+      break;
+    }
+    size_t k = bucketOf(entries_[j].id);
+    // Movable if its bucket is not cyclically in (i, j].
+    bool movable = i <= j ? (k <= i || k > j) : (k <= i && k > j);
+    if (movable) {
+      entries_[i].id = entries_[j].id;
+      entries_[i].conn.swap(entries_[j].conn);
+      i = j;
+    }
+  }
+
+  entries_[i].id = 0;
+  entries_[i].conn.reset();
+  --size_;
+  return true;
+}
+
+TcpConnectionPtr ConnectionTable::find(uint64 id) const {
+  const Entry& entry = entries_[probe(id)];
+  return entry.id != 0 ? entry.conn : TcpConnectionPtr();
+}
+
+void ConnectionTable::takeAll(std::vector<TcpConnectionPtr>* conns) {
+  conns->reserve(conns->size() + size_);
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    if (entries_[i].id != 0) {
+      conns->push_back(TcpConnectionPtr());
+      conns->back().swap(entries_[i].conn);
+      entries_[i].id = 0;
+    }
+  }
+  size_ = 0;
+}
+
+void ConnectionTable::forEach(const ConnectionCb& cb) const {
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    if (entries_[i].id != 0) {
+      cb(entries_[i].conn);
+    }
+  }
+}
+
+void ConnectionTable::grow() {
+  std::vector<Entry> old(entries_.size() * 2);
+  old.swap(entries_);
+  mask_ = entries_.size() - 1;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    entries_[i].id = 0;
+  }
+
+  for (size_t i = 0; i < old.size(); ++i) {
+    if (old[i].id != 0) {
+      Entry& entry = entries_[probe(old[i].id)];
+      entry.id = old[i].id;
+      entry.conn.swap(old[i].conn);
+    }
+  }
+}
+
+}  // namespace cobra
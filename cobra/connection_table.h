@@ -0,0 +1,71 @@
+// Author: Jianbo Zhu
+//
+// A flat hash table of connections keyed by their integer id.
+
+#ifndef COBRA_CONNECTION_TABLE_H_
+#define COBRA_CONNECTION_TABLE_H_
+
+#include <vector>
+
+#include "base/basic_types.h"
+#include "base/macros.h"
+#include "cobra/callbacks.h"
+
+namespace cobra {
+
+// Open addressing with linear probing, in one array. Ids are handed out
+// in sequence, so Fibonacci hashing spreads them evenly, and removal
+// shifts the following entries back instead of leaving tombstones.
+//
+// Not thread safe.
+class ConnectionTable {
+ public:
+  ConnectionTable();
+  ~ConnectionTable();
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // 'id' must be non zero and not in the table yet.
+  void insert(uint64 id, const TcpConnectionPtr& conn);
+
+  // @return false if 'id' is not in the table.
+  bool erase(uint64 id);
+
+  // An empty pointer if 'id' is not in the table.
+  TcpConnectionPtr find(uint64 id) const;
+
+  // Moves all the connections to 'conns', leaving the table empty.
+  void takeAll(std::vector<TcpConnectionPtr>* conns);
+
+  // Calls 'cb' with each connection, 'cb' must not change the table.
+  void forEach(const ConnectionCb& cb) const;
+
+ private:
+  static const size_t kInitialCapacity = 64;
+
+  struct Entry {
+    // 0 if the entry is free.
+    uint64 id;
+    TcpConnectionPtr conn;
+  };
+
+  size_t bucketOf(uint64 id) const {
+    // Fibonacci hashing, the high bits are the well mixed ones.
+    return static_cast<size_t>((id * 0x9E3779B97F4A7C15ULL) >> 32) & mask_;
+  }
+
+  // The index of 'id', or of the free entry where it would go.
+  size_t probe(uint64 id) const;
+  void grow();
+
+  std::vector<Entry> entries_;
+  size_t mask_;
+  size_t size_;
+
+  DISABLE_COPY_AND_ASSIGN(ConnectionTable);
+};
+
+}  // namespace cobra
+
+#endif  // COBRA_CONNECTION_TABLE_H_
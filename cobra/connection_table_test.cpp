@@ -0,0 +1,185 @@
+// Author: Jianbo Zhu
+//
+// ConnectionTable against a std::map: clusters wrapping around the end
+// of the array, erase and find mixed, and growth in the middle of it.
+
+#include "cobra/connection_table.h"
+
+#include <stdlib.h>
+
+#include <map>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <gtest/gtest.h>
+
+namespace cobra {
+namespace {
+
+// As in ConnectionTable.
+const size_t kInitialCapacity = 64;
+
+size_t bucketOf(uint64 id, size_t capacity) {
+  return static_cast<size_t>((id * 0x9E3779B97F4A7C15ULL) >> 32) &
+         (capacity - 1);
+}
+
+// The ids of the first 'n' ids from 1 on falling in 'bucket'.
+std::vector<uint64> idsIn(size_t bucket, size_t capacity, int n) {
+  std::vector<uint64> ids;
+  for (uint64 id = 1; static_cast<int>(ids.size()) < n; ++id) {
+    if (bucketOf(id, capacity) == bucket) {
+      ids.push_back(id);
+    }
+  }
+  return ids;
+}
+
+// The connections are never dereferenced, only compared: distinct
+// addresses, nothing to delete.
+struct NoDelete {
+  void operator()(TcpConnection*) const {}
+};
+
+char g_anchors[1 << 16];
+
+TcpConnectionPtr connOf(uint64 id) {
+  return TcpConnectionPtr(
+      reinterpret_cast<TcpConnection*>(&g_anchors[id % sizeof g_anchors]),
+      NoDelete());
+}
+
+typedef std::map<uint64, TcpConnectionPtr> Model;
+
+void countConn(size_t* n, const TcpConnectionPtr&) {
+  ++*n;
+}
+
+// Every id of 'model' is found with its connection, the others aren't.
+void expectSame(const ConnectionTable& table,
+                const Model& model,
+                const std::vector<uint64>& absent) {
+  ASSERT_EQ(model.size(), table.size());
+  for (Model::const_iterator it = model.begin(); it != model.end(); ++it) {
+    ASSERT_EQ(it->second.get(), table.find(it->first).get()) << it->first;
+  }
+  for (size_t i = 0; i < absent.size(); ++i) {
+    if (model.find(absent[i]) == model.end()) {
+      ASSERT_FALSE(table.find(absent[i])) << absent[i];
+    }
+  }
+}
+
+TEST(ConnectionTableTest, ClustersWrappingAround) {
+  const size_t last = kInitialCapacity - 1;
+  // A cluster starting at the last entry spills over to 0, 1, 2..., where
+  // the ids of buckets 0 and 1 land behind it.
+  const std::vector<uint64> atLast = idsIn(last, kInitialCapacity, 4);
+  const std::vector<uint64> atFirst = idsIn(0, kInitialCapacity, 3);
+  const std::vector<uint64> atSecond = idsIn(1, kInitialCapacity, 2);
+  const std::vector<uint64> beforeLast = idsIn(last - 1, kInitialCapacity, 2);
+
+  std::vector<uint64> all;
+  all.insert(all.end(), beforeLast.begin(), beforeLast.end());
+  all.insert(all.end(), atLast.begin(), atLast.end());
+  all.insert(all.end(), atFirst.begin(), atFirst.end());
+  all.insert(all.end(), atSecond.begin(), atSecond.end());
+  // Below half full, no growth.
+  ASSERT_LT(all.size() * 2, kInitialCapacity);
+
+  // Every erase order of the first few is a different shift, go through
+  // each id erased first, then the rest in turns.
+  for (size_t first = 0; first < all.size(); ++first) {
+    ConnectionTable table;
+    Model model;
+    for (size_t i = 0; i < all.size(); ++i) {
+      table.insert(all[i], connOf(all[i]));
+      model[all[i]] = connOf(all[i]);
+    }
+    expectSame(table, model, all);
+
+    for (size_t n = 0; n < all.size(); ++n) {
+      const uint64 id = all[(first + n * 5) % all.size()];
+      const bool present = model.erase(id) != 0;
+      ASSERT_EQ(present, table.erase(id)) << id;
+      expectSame(table, model, all);
+      // And back in, sometimes, so holes get filled again.
+      if (n % 3 == 2) {
+        table.insert(id, connOf(id));
+        model[id] = connOf(id);
+        expectSame(table, model, all);
+      }
+    }
+  }
+}
+
+TEST(ConnectionTableTest, EraseMissing) {
+  ConnectionTable table;
+  const std::vector<uint64> ids = idsIn(kInitialCapacity - 1,
+                                        kInitialCapacity, 3);
+  table.insert(ids[0], connOf(ids[0]));
+  table.insert(ids[1], connOf(ids[1]));
+  // Probes through the cluster, finds the free entry past it.
+  EXPECT_FALSE(table.erase(ids[2]));
+  EXPECT_TRUE(table.erase(ids[0]));
+  EXPECT_FALSE(table.erase(ids[0]));
+  EXPECT_EQ(connOf(ids[1]).get(), table.find(ids[1]).get());
+  EXPECT_EQ(1u, table.size());
+}
+
+TEST(ConnectionTableTest, ChurnWhileGrowing) {
+  ConnectionTable table;
+  Model model;
+  std::vector<uint64> seen;
+  // Ids in sequence as the server hands them out, and ids crowding the
+  // last bucket of the table as it grows.
+  uint64 nextId = 1;
+  unsigned seed = 1;
+  for (int step = 0; step < 20000; ++step) {
+    const int op = rand_r(&seed) % 10;
+    if (op < 5 || model.empty()) {
+      uint64 id = nextId++;
+      if (op == 0) {
+        // The next id hashed to the last entry, at any capacity up to
+        // 4096.
+        while (bucketOf(id, 4096) != 4095) {
+          ++id;
+        }
+        nextId = id + 1;
+      }
+      table.insert(id, connOf(id));
+      model[id] = connOf(id);
+      seen.push_back(id);
+    } else if (op < 8) {
+      // Erase, maybe one erased already.
+      const uint64 id = seen[rand_r(&seed) % seen.size()];
+      const bool present = model.erase(id) != 0;
+      ASSERT_EQ(present, table.erase(id)) << id;
+    } else {
+      // Find, maybe of an erased one.
+      const uint64 id = seen[rand_r(&seed) % seen.size()];
+      Model::const_iterator it = model.find(id);
+      ASSERT_EQ(it == model.end() ? NULL : it->second.get(),
+                table.find(id).get()) << id;
+    }
+    if (step % 1000 == 0) {
+      expectSame(table, model, seen);
+    }
+  }
+  expectSame(table, model, seen);
+  // Grew past a few capacities meanwhile.
+  ASSERT_GT(model.size(), 4 * kInitialCapacity);
+
+  size_t visited = 0;
+  table.forEach(boost::bind(&countConn, &visited, _1));
+  EXPECT_EQ(model.size(), visited);
+
+  std::vector<TcpConnectionPtr> conns;
+  table.takeAll(&conns);
+  EXPECT_EQ(model.size(), conns.size());
+  EXPECT_TRUE(table.empty());
+  EXPECT_FALSE(table.find(model.begin()->first));
+}
+
+}  // Anonymous namespace
+}  // namespace cobra
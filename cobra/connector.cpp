@@ -13,13 +13,21 @@ namespace cobra {
 
 const int Connector::kMaxRetryDelayMs;
 const int Connector::kInitRetryDelayMs;
+const int Connector::kDefaultConnectTimeoutMs;
 
 Connector::Connector(Worker* loop, const Endpoint& serverAddr)
   : state_(kDisconnected),
     loop_(loop),
     serverAddr_(serverAddr),
     connect_(false),
-    retryDelayMs_(kInitRetryDelayMs) {
+    retryDelayMs_(kInitRetryDelayMs),
+    connectTimeout_(kDefaultConnectTimeoutMs / 1000.0),
+    seed_(static_cast<uint32>(reinterpret_cast<uintptr_t>(this))
+          ^ static_cast<uint32>(Timestamp::now().microSecondsSinceEpoch())
+          ^ serverAddr.portNetEndian()) {
+  if (seed_ == 0) {
+    seed_ = 2463534242u;
+  }
   LOG_DEBUG << "ctor[" << this << "]";
 }
 
@@ -60,7 +68,9 @@ void Connector::stopInLoop() {
 
 void Connector::connect() {
   int sockfd = createNonblockingOrDie();
-  int ret = connect(sockfd, serverAddr_.getSockAddrInet());
+  attempts_.increment();
+  attemptStart_ = Timestamp::now();
+  int ret = cobra::connect(sockfd, serverAddr_.getSockAddrInet());
   int savedErrno = (ret == 0) ? 0 : errno;
   switch (savedErrno)
   {
@@ -87,11 +97,13 @@ void Connector::connect() {
     case EFAULT:
     case ENOTSOCK:
       LOG_SYSERR << "connect error in Connector::startInLoop " << savedErrno;
+      failures_.increment();
       close(sockfd);
       break;
 
     default:
       LOG_SYSERR << "Unexpected error in Connector::startInLoop " << savedErrno;
+      failures_.increment();
       close(sockfd);
       // connectErrorCb_();
       break;
@@ -110,17 +122,27 @@ void Connector::connecting(int sockfd) {
   setState(kConnecting);
   assert(!channel_);
   channel_.reset(new Channel(loop_, sockfd));
-  channel_->setWriteCb(
+  channel_->SetWriteCb(
       boost::bind(&Connector::handleWrite, this)); // FIXME: unsafe
-  channel_->setErrorCb(
+  channel_->SetErrorCb(
       boost::bind(&Connector::handleError, this)); // FIXME: unsafe
 
   // channel_->tie(shared_from_this()); is not working,
   // as channel_ is not managed by shared_ptr
   channel_->enableWriting();
+
+  if (connectTimeout_ > 0.0) {
+    // Canceled once the attempt is over, @see removeAndResetChannel.
+    timeoutTimer_ = loop_->runAfter(
+        connectTimeout_,
+        boost::bind(&Connector::handleTimeout, shared_from_this()));
+  }
 }
 
 int Connector::removeAndResetChannel() {
+  if (connectTimeout_ > 0.0) {
+    loop_->cancel(timeoutTimer_);
+  }
   channel_->disableAll();
   channel_->remove();
   int sockfd = channel_->fd();
@@ -148,6 +170,9 @@ void Connector::handleWrite() {
       retry(sockfd);
     } else {
       setState(kConnected);
+      successes_.increment();
+      latencyUs_.add(Timestamp::now().microSecondsSinceEpoch()
+                     - attemptStart_.microSecondsSinceEpoch());
       if (connect_) {
         new_conn_cb_(sockfd);
       } else {
@@ -170,18 +195,44 @@ void Connector::handleError() {
   }
 }
 
+void Connector::handleTimeout() {
+  if (state_ == kConnecting) {
+    LOG_WARN << "Connector::handleTimeout - connecting to "
+             << serverAddr_.toIpPort() << " timed out after "
+             << connectTimeout_ << " seconds";
+    timeouts_.increment();
+    int sockfd = removeAndResetChannel();
+    retry(sockfd);
+  }
+}
+
 void Connector::retry(int sockfd) {
   close(sockfd);
   setState(kDisconnected);
   if (connect_) {
+    failures_.increment();
+    retryDelayMs_ = nextRetryDelayMs();
     LOG_INFO << "Connector::retry - Retry connecting to " << serverAddr_.toIpPort()
              << " in " << retryDelayMs_ << " milliseconds. ";
     loop_->runAfter(retryDelayMs_/1000.0,
                     boost::bind(&Connector::startInLoop, shared_from_this()));
-    retryDelayMs_ = std::min(retryDelayMs_ * 2, kMaxRetryDelayMs);
   } else {
     LOG_DEBUG << "do not connect";
   }
 }
 
+int Connector::nextRetryDelayMs() {
+  const uint32 upper = static_cast<uint32>(retryDelayMs_) * 3;
+  const uint32 span = upper - kInitRetryDelayMs + 1;
+  const int delay = kInitRetryDelayMs + static_cast<int>(random() % span);
+  return std::min(delay, kMaxRetryDelayMs);
+}
+
+uint32 Connector::random() {
+  seed_ ^= seed_ << 13;
+  seed_ ^= seed_ >> 17;
+  seed_ ^= seed_ << 5;
+  return seed_;
+}
+
 }  // namespace cobra
@@ -5,8 +5,12 @@
 #include <boost/function.hpp>
 #include <boost/scoped_ptr.hpp>
 
+#include "base/Atomic.h"
+#include "base/basic_types.h"
 #include "base/macros.h"
+#include "base/timestamp.h"
 #include "cobra/endpoint.h"
+#include "cobra/timer_id.h"
 
 namespace cobra {
 
@@ -17,18 +21,42 @@ class Connector : public boost::enable_shared_from_this<Connector> {
  public:
   typedef boost::function<void (int sockfd)> NewConnectionCb;
 
+  static const int kDefaultConnectTimeoutMs = 5000;
+
   Connector(Worker* loop, const Endpoint& serverAddr);
   ~Connector();
 
   void setNewConnectionCb(const NewConnectionCb& cb)
   { new_conn_cb_ = cb; }
 
+  // Gives up an attempt not connected after 'seconds' and retries, so a
+  // SYN lost in a blackhole doesn't wait for the kernel to give up.
+  // kDefaultConnectTimeoutMs by default, 0 waits for the kernel.
+  // Must be called before start, the connector must be owned by a
+  // shared_ptr for it.
+  void setConnectTimeout(double seconds) { connectTimeout_ = seconds; }
+
   void start();  // can be called in any thread
   void restart();  // must be called in loop thread
   void stop();  // can be called in any thread
 
   const Endpoint& serverAddress() const { return serverAddr_; }
 
+  ////////////////////// begin /////////////////////////////////
+  // Thread safe.
+
+  int64 connectAttempts() { return attempts_.get(); }
+  // Failed attempts, timeouts included.
+  int64 connectFailures() { return failures_.get(); }
+  int64 connectTimeouts() { return timeouts_.get(); }
+  int64 connectSuccesses() { return successes_.get(); }
+  // Average time from connect(2) to connected, 0 if none yet.
+  int64 averageConnectLatencyUs() {
+    const int64 n = successes_.get();
+    return n > 0 ? latencyUs_.get() / n : 0;
+  }
+  ///////////////////////// end ///////////////////////////////
+
  private:
   enum States { kDisconnected, kConnecting, kConnected };
   States state_;  // FIXME: use atomic variable
@@ -44,7 +72,15 @@ class Connector : public boost::enable_shared_from_this<Connector> {
   void connecting(int sockfd);
   void handleWrite();
   void handleError();
+  // The connect deadline of the attempt expired.
+  void handleTimeout();
   void retry(int sockfd);
+  // The delay after 'retryDelayMs_', decorrelated jitter: drawn between
+  // kInitRetryDelayMs and three times the last one, so that clients
+  // dropped together don't come back in lockstep.
+  int nextRetryDelayMs();
+  // xorshift32, in loop thread.
+  uint32 random();
   int removeAndResetChannel();
   void resetChannel();
 
@@ -54,6 +90,18 @@ class Connector : public boost::enable_shared_from_this<Connector> {
   boost::scoped_ptr<Channel> channel_;
   NewConnectionCb new_conn_cb_;
   int retryDelayMs_;
+  double connectTimeout_;
+  // Of the current attempt.
+  Timestamp attemptStart_;
+  TimerId timeoutTimer_;
+  uint32 seed_;
+
+  AtomicInt64 attempts_;
+  AtomicInt64 failures_;
+  AtomicInt64 timeouts_;
+  AtomicInt64 successes_;
+  // Summed over the successes.
+  AtomicInt64 latencyUs_;
 };
 
 }  // namespace cobra
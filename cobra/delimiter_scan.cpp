@@ -0,0 +1,119 @@
+#include "cobra/delimiter_scan.h"
+
+#if COBRA_SCAN_X86
+#include <immintrin.h>
+#endif
+
+namespace cobra {
+
+namespace detail {
+
+const char* findCRLFScalar(const char* begin, const char* end) {
+  if (end - begin < 2) {
+    return NULL;
+  }
+  // A '\n' preceded by a '\r', memchr skips the rest quickly.
+  const char* p = begin + 1;
+  while (p < end) {
+    p = static_cast<const char*>(
+        ::memchr(p, '\n', static_cast<size_t>(end - p)));
+    if (p == NULL) {
+      return NULL;
+    }
+    if (p[-1] == '\r') {
+      return p - 1;
+    }
+    ++p;
+  }
+  return NULL;
+}
+
+#if COBRA_SCAN_X86
+
+// Bit i of the result is set if begin[i] == '\r' and begin[i + 1] == '\n'.
+// Loading at p and p + 1 covers the pairs straddling two blocks.
+
+const char* findCRLFSse2(const char* begin, const char* end) {
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  const char* p = begin;
+  for (; end - p >= 17; p += 16) {
+    const __m128i a =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+    const int mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, cr), _mm_cmpeq_epi8(b, lf)));
+    if (mask != 0) {
+      return p + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+  }
+  return findCRLFScalar(p, end);
+}
+
+__attribute__((target("avx2")))
+const char* findCRLFAvx2(const char* begin, const char* end) {
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  const char* p = begin;
+  for (; end - p >= 33; p += 32) {
+    const __m256i a =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+    const int mask = _mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(a, cr), _mm256_cmpeq_epi8(b, lf)));
+    if (mask != 0) {
+      return p + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+  }
+  return findCRLFSse2(p, end);
+}
+
+#endif  // COBRA_SCAN_X86
+
+}  // namespace detail
+
+namespace {
+
+typedef const char* (*FindCRLFFunc)(const char* begin, const char* end);
+
+#if COBRA_SCAN_X86
+
+FindCRLFFunc chooseFindCRLF() {
+  // May run before main, where the cpu model isn't set up yet.
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return detail::findCRLFAvx2;
+  }
+  return detail::findCRLFSse2;
+}
+
+#else
+
+FindCRLFFunc chooseFindCRLF() {
+  return detail::findCRLFScalar;
+}
+
+#endif  // COBRA_SCAN_X86
+
+const char* findCRLFFirstCall(const char* begin, const char* end);
+
+// Statically initialized, so it's usable from other static initializers.
+// Threads racing on the first call all store the same function, through
+// atomic builtins, which are plain moves on x86.
+FindCRLFFunc findCRLFImpl = findCRLFFirstCall;
+
+const char* findCRLFFirstCall(const char* begin, const char* end) {
+  const FindCRLFFunc impl = chooseFindCRLF();
+  __atomic_store_n(&findCRLFImpl, impl, __ATOMIC_RELEASE);
+  return impl(begin, end);
+}
+
+}  // Anonymous namespace
+
+const char* findCRLF(const char* begin, const char* end) {
+  return __atomic_load_n(&findCRLFImpl, __ATOMIC_ACQUIRE)(begin, end);
+}
+
+}  // namespace cobra
@@ -0,0 +1,45 @@
+// Author: Jianbo Zhu
+//
+// Delimiter search in byte ranges, vectorized where the CPU allows it.
+
+#ifndef COBRA_DELIMITER_SCAN_H_
+#define COBRA_DELIMITER_SCAN_H_
+
+#include <string.h>
+
+namespace cobra {
+
+// The first 'c' in [begin, end), NULL if none.
+//
+// memchr(3) of glibc is already vectorized and picks SSE2/AVX2/AVX-512
+// at runtime, it's used as is.
+inline const char* findByte(const char* begin, const char* end, char c) {
+  return static_cast<const char*>(
+      ::memchr(begin, c, static_cast<size_t>(end - begin)));
+}
+
+// The first "\r\n" in [begin, end), NULL if none.
+//
+// Compares 32 (AVX2) or 16 (SSE2) positions at once for a '\r' followed
+// by a '\n', the implementation is picked at startup from what the CPU
+// supports.
+const char* findCRLF(const char* begin, const char* end);
+
+namespace detail {
+
+// The implementations findCRLF picks from, for the tests.
+const char* findCRLFScalar(const char* begin, const char* end);
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define COBRA_SCAN_X86 1
+const char* findCRLFSse2(const char* begin, const char* end);
+// Only on CPUs supporting AVX2.
+__attribute__((target("avx2")))
+const char* findCRLFAvx2(const char* begin, const char* end);
+#endif
+
+}  // namespace detail
+
+}  // namespace cobra
+
+#endif  // COBRA_DELIMITER_SCAN_H_
@@ -0,0 +1,178 @@
+// Author: Jianbo Zhu
+//
+// The findCRLF kernels against std::search, and LineCodec resuming a
+// scan across reads.
+
+#include "cobra/delimiter_scan.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <gtest/gtest.h>
+
+#include "cobra/buffer.h"
+#include "cobra/line_codec.h"
+
+namespace cobra {
+namespace {
+
+typedef const char* (*FindCRLFFunc)(const char* begin, const char* end);
+
+struct Kernel {
+  const char* name;
+  FindCRLFFunc find;
+};
+
+// The kernels the running CPU can run.
+std::vector<Kernel> kernels() {
+  std::vector<Kernel> result;
+  const Kernel scalar = { "scalar", detail::findCRLFScalar };
+  result.push_back(scalar);
+#if COBRA_SCAN_X86
+  const Kernel sse2 = { "sse2", detail::findCRLFSse2 };
+  result.push_back(sse2);
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    const Kernel avx2 = { "avx2", detail::findCRLFAvx2 };
+    result.push_back(avx2);
+  }
+#endif
+  const Kernel dispatched = { "findCRLF", findCRLF };
+  result.push_back(dispatched);
+  return result;
+}
+
+const char* expected(const char* begin, const char* end) {
+  static const char kCRLF[] = "\r\n";
+  const char* p = std::search(begin, end, kCRLF, kCRLF + 2);
+  return p == end ? NULL : p;
+}
+
+// Up to two lanes of 32, on either side of them.
+const size_t kMaxLen = 72;
+// Room for every alignment of 'begin' within a lane.
+const size_t kMaxOffset = 32;
+
+class FindCRLFTest : public ::testing::Test {
+ protected:
+  FindCRLFTest() : kernels_(kernels()) {
+    memset(memory_, 'x', sizeof memory_);
+  }
+
+  // Checks every kernel on [begin, begin + len).
+  void expectAllMatch(const char* begin, size_t len) {
+    const char* end = begin + len;
+    const char* want = expected(begin, end);
+    for (size_t k = 0; k < kernels_.size(); ++k) {
+      ASSERT_EQ(want, kernels_[k].find(begin, end))
+          << kernels_[k].name << ", length " << len
+          << ", offset " << (begin - memory_);
+    }
+  }
+
+  std::vector<Kernel> kernels_;
+  char memory_[kMaxOffset + kMaxLen + 64];
+};
+
+TEST_F(FindCRLFTest, EveryPosition) {
+  for (size_t offset = 0; offset < kMaxOffset; ++offset) {
+    char* begin = memory_ + offset;
+    for (size_t len = 0; len <= kMaxLen; ++len) {
+      // None at all, then "\r\n" at each position, straddling the 16 and
+      // 32 byte lanes at some of them.
+      expectAllMatch(begin, len);
+      for (size_t pos = 0; pos + 1 < len; ++pos) {
+        begin[pos] = '\r';
+        begin[pos + 1] = '\n';
+        expectAllMatch(begin, len);
+        begin[pos] = 'x';
+        begin[pos + 1] = 'x';
+      }
+    }
+  }
+}
+
+TEST_F(FindCRLFTest, LoneAndReversed) {
+  for (size_t offset = 0; offset < kMaxOffset; ++offset) {
+    char* begin = memory_ + offset;
+    for (size_t pos = 0; pos + 1 < kMaxLen; ++pos) {
+      // Lone '\r' and '\n' and "\n\r" around, only the real one counts.
+      memset(begin, 'x', kMaxLen);
+      for (size_t i = 0; i < kMaxLen; i += 3) {
+        begin[i] = i % 2 ? '\r' : '\n';
+      }
+      begin[pos] = '\n';
+      begin[pos + 1] = '\r';
+      expectAllMatch(begin, kMaxLen);
+      begin[pos] = '\r';
+      begin[pos + 1] = '\n';
+      expectAllMatch(begin, kMaxLen);
+    }
+  }
+}
+
+TEST_F(FindCRLFTest, CRLastReadable) {
+  for (size_t offset = 0; offset < kMaxOffset; ++offset) {
+    char* begin = memory_ + offset;
+    for (size_t len = 1; len <= kMaxLen; ++len) {
+      // The '\n' right past the end isn't ours.
+      begin[len - 1] = '\r';
+      begin[len] = '\n';
+      for (size_t k = 0; k < kernels_.size(); ++k) {
+        ASSERT_EQ(NULL, kernels_[k].find(begin, begin + len))
+            << kernels_[k].name << ", length " << len
+            << ", offset " << offset;
+      }
+      begin[len - 1] = 'x';
+      begin[len] = 'x';
+    }
+  }
+}
+
+void addLine(std::vector<std::string>* lines,
+             const TcpConnectionPtr&,
+             const StringPiece& line,
+             Timestamp) {
+  lines->push_back(std::string(line.data(), line.size()));
+}
+
+// The lines of 'input' fed to a kCRLF LineCodec in two reads split at
+// 'split'.
+std::vector<std::string> splitFeed(const std::string& input, size_t split) {
+  std::vector<std::string> lines;
+  LineCodec codec(LineCodec::kCRLF, boost::bind(&addLine, &lines, _1, _2, _3));
+  // Only used on lines too long, there are none.
+  const TcpConnectionPtr conn;
+  Buffer buffer;
+  buffer.append(input.data(), split);
+  codec.onMessage(conn, &buffer, Timestamp());
+  buffer.append(input.data() + split, input.size() - split);
+  codec.onMessage(conn, &buffer, Timestamp());
+  EXPECT_EQ(0u, buffer.readableBytes());
+  return lines;
+}
+
+TEST(LineCodecTest, LineSplitAcrossReads) {
+  // Lines across the 16 and 32 byte lanes, with stray '\r' and '\n'.
+  const std::string first(40, 'a');
+  const std::string second = "b\rb\nb" + std::string(30, 'b');
+  const std::string input = first + "\r\n" + second + "\r\n\r\nc\r\n";
+  std::vector<std::string> want;
+  want.push_back(first);
+  want.push_back(second);
+  want.push_back("");
+  want.push_back("c");
+
+  // Every split, in particular between a '\r' and its '\n', where the
+  // resumed scan has to step back a byte.
+  for (size_t split = 0; split <= input.size(); ++split) {
+    ASSERT_EQ(want, splitFeed(input, split)) << "split at " << split;
+  }
+}
+
+}  // Anonymous namespace
+}  // namespace cobra
@@ -59,7 +59,7 @@ string Endpoint::toIpPort() const {
   char host[INET_ADDRSTRLEN] = "INVALID";
   ::inet_ntop(AF_INET,
               &addr_.sin_addr,
-              buf,
+              host,
               static_cast<socklen_t>(sizeof(host)));
   uint16_t port = networkToHost16(addr_.sin_port);
   snprintf(buf, sizeof(buf), "%s:%u", host, port);
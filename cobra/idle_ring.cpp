@@ -0,0 +1,77 @@
+#include "cobra/idle_ring.h"
+
+#include <math.h>
+
+#include <boost/bind.hpp>
+
+#include "cobra/worker.h"
+
+namespace cobra {
+
+const double IdleRing::kMaxTickSeconds = 1.0;
+
+IdleRing::IdleRing(Worker* loop, double timeout, const ExpireCb& cb)
+  : loop_(loop),
+    timeout_(timeout),
+    expireCb_(cb),
+    current_(0) {
+  assert(timeout > 0.0);
+  const double tick = timeout < kMaxTickSeconds ? timeout : kMaxTickSeconds;
+  // A bucket is swept once all the others have been current, so
+  // one more than the ticks in 'timeout'.
+  buckets_.resize(static_cast<size_t>(ceil(timeout / tick)) + 1);
+  for (size_t i = 0; i < buckets_.size(); ++i) {
+    buckets_[i].prev = &buckets_[i];
+    buckets_[i].next = &buckets_[i];
+  }
+  timerId_ = loop_->runEvery(tick, boost::bind(&IdleRing::advance, this));
+}
+
+IdleRing::~IdleRing() {
+  loop_->cancel(timerId_);
+  for (size_t i = 0; i < buckets_.size(); ++i) {
+    while (buckets_[i].next != &buckets_[i]) {
+      unlink(buckets_[i].next);
+    }
+  }
+}
+
+void IdleRing::link(Node* node, int bucket) {
+  Node* head = &buckets_[bucket];
+  node->prev = head->prev;
+  node->next = head;
+  head->prev->next = node;
+  head->prev = node;
+  node->bucket = bucket;
+}
+
+void IdleRing::unlink(Node* node) {
+  if (node->bucket < 0) {
+    return;
+  }
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  node->prev = NULL;
+  node->next = NULL;
+  node->bucket = -1;
+}
+
+void IdleRing::advance() {
+  loop_->assertInLoopThread();
+  // The oldest bucket, next in the ring. The current one stays current
+  // while we close, in case some get touched meanwhile.
+  int oldest = current_ + 1;
+  if (implicit_cast<size_t>(oldest) == buckets_.size()) {
+    oldest = 0;
+  }
+
+  Node* head = &buckets_[oldest];
+  while (head->next != head) {
+    Node* node = head->next;
+    unlink(node);
+    expireCb_(node->conn);
+  }
+  current_ = oldest;
+}
+
+}  // namespace cobra
@@ -0,0 +1,94 @@
+// Author: Jianbo Zhu
+//
+// Idle timeout of the connections of a loop, with a ring of buckets.
+
+#ifndef COBRA_IDLE_RING_H_
+#define COBRA_IDLE_RING_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include "base/basic_types.h"
+#include "base/macros.h"
+#include "cobra/timer_id.h"
+
+namespace cobra {
+
+class TcpConnection;
+class Worker;
+
+// Expires the connections without reads nor writes for 'timeout'
+// seconds, up to a tick later.
+//
+// The connections are linked into the bucket of the current tick when
+// they are active, which is O(1) and a no-op most of the time, since
+// they are already there. A single timer per ring advances it every
+// tick, and expires what is left in the oldest bucket. No timer per
+// connection to cancel and rearm on every read.
+//
+// Not thread safe, used in the loop thread only.
+class IdleRing {
+ public:
+  // Called in the loop with an expired connection, out of the ring.
+  typedef boost::function<void (TcpConnection*)> ExpireCb;
+
+  // Linked into a bucket, embedded in the connection.
+  struct Node {
+    Node()
+      : prev(NULL),
+        next(NULL),
+        bucket(-1),
+        conn(NULL) {
+    }
+
+    Node* prev;
+    Node* next;
+    // -1 if not in the ring.
+    int bucket;
+    TcpConnection* conn;
+  };
+
+  IdleRing(Worker* loop, double timeout, const ExpireCb& cb);
+  ~IdleRing();
+
+  double timeout() const { return timeout_; }
+
+  // Marks the connection of 'node' active now, adding it if needed.
+  void touch(Node* node) {
+    if (node->bucket != current_) {
+      unlink(node);
+      link(node, current_);
+    }
+  }
+
+  // Takes the connection of 'node' out of the ring.
+  void remove(Node* node) {
+    unlink(node);
+  }
+
+ private:
+  // The coarsest tick, finer for short timeouts.
+  static const double kMaxTickSeconds;
+
+  void link(Node* node, int bucket);
+  void unlink(Node* node);
+  // Run by the timer every tick.
+  void advance();
+
+  Worker* loop_;
+  const double timeout_;
+  ExpireCb expireCb_;
+  // Sentinels of circular lists.
+  std::vector<Node> buckets_;
+  int current_;
+  TimerId timerId_;
+
+  DISABLE_COPY_AND_ASSIGN(IdleRing);
+};
+
+}  // namespace cobra
+
+#endif  // COBRA_IDLE_RING_H_
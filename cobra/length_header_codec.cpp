@@ -0,0 +1,87 @@
+#include "cobra/length_header_codec.h"
+
+#include "base/Logging.h"
+#include "cobra/tcp_connection.h"
+
+namespace cobra {
+
+namespace {
+
+// Binds the connection and time of a read to the frames.
+class FrameDispatcher {
+ public:
+  FrameDispatcher(const LengthHeaderCodec::FrameCb& cb,
+                  const TcpConnectionPtr& conn,
+                  Timestamp receiveTime)
+    : cb_(cb), conn_(conn), receiveTime_(receiveTime) {
+  }
+
+  void operator()(const StringPiece& frame) {
+    cb_(conn_, frame, receiveTime_);
+  }
+
+ private:
+  const LengthHeaderCodec::FrameCb& cb_;
+  const TcpConnectionPtr& conn_;
+  const Timestamp receiveTime_;
+};
+
+}  // Anonymous namespace
+
+LengthHeaderCodec::LengthHeaderCodec(HeaderType type,
+                                     const FrameCb& cb,
+                                     size_t maxFrameSize)
+  : LengthHeaderFramer(type, maxFrameSize),
+    frameCb_(cb) {
+}
+
+void LengthHeaderCodec::onMessage(const TcpConnectionPtr& conn,
+                                  Buffer* buffer,
+                                  Timestamp receiveTime) {
+  FrameDispatcher dispatcher(frameCb_, conn, receiveTime);
+  size_t badLength = 0;
+  if (!decode(buffer, dispatcher, &badLength)) {
+    frameError(conn, buffer, badLength);
+  }
+}
+
+bool LengthHeaderCodec::send(const TcpConnectionPtr& conn,
+                             Buffer* buffer) const {
+  if (!encode(buffer)) {
+    // The header couldn't tell its length, or the peer would drop it.
+    LOG_ERROR << "LengthHeaderCodec::send - frame of "
+              << buffer->readableBytes() << " bytes, max " << maxFrameSize();
+    return false;
+  }
+  conn->send(buffer);
+  return true;
+}
+
+bool LengthHeaderCodec::send(const TcpConnectionPtr& conn,
+                             const StringPiece& frame) const {
+  if (static_cast<size_t>(frame.size()) > maxFrameSize()) {
+    // Before copying it.
+    LOG_ERROR << "LengthHeaderCodec::send - frame of " << frame.size()
+              << " bytes, max " << maxFrameSize();
+    return false;
+  }
+  Buffer buffer;
+  buffer.append(frame);
+  return send(conn, &buffer);
+}
+
+void LengthHeaderCodec::frameError(const TcpConnectionPtr& conn,
+                                   Buffer* buffer,
+                                   size_t length) {
+  LOG_ERROR << "LengthHeaderCodec - " << conn->name()
+            << " bad frame header, length " << length
+            << ", max " << maxFrameSize();
+  if (frameErrorCb_) {
+    frameErrorCb_(conn, length);
+  }
+  // Nothing after it can be trusted.
+  buffer->retrieveAll();
+  conn->forceClose();
+}
+
+}  // namespace cobra
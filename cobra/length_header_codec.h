@@ -0,0 +1,76 @@
+// Author: Jianbo Zhu
+//
+// Frames delimited by a length header.
+
+#ifndef COBRA_LENGTH_HEADER_CODEC_H_
+#define COBRA_LENGTH_HEADER_CODEC_H_
+
+#include <boost/function.hpp>
+
+#include "base/basic_types.h"
+#include "base/macros.h"
+#include "base/string_piece.h"
+#include "base/timestamp.h"
+#include "cobra/buffer.h"
+#include "cobra/callbacks.h"
+#include "cobra/length_header_framer.h"
+
+namespace cobra {
+
+// Splits the input of a connection into frames, each preceded by its
+// length, and frames the output likewise, @see LengthHeaderFramer for
+// the framing itself.
+//
+// Complete frames are handed out as views into the input buffer, with
+// no copy, however many arrived in one read. A header announcing more
+// than the max frame size closes the connection right away, without
+// buffering the frame first.
+//
+// @code
+// LengthHeaderCodec codec(LengthHeaderCodec::kInt32, onFrame);
+// server.SetMessageCb(
+//     boost::bind(&LengthHeaderCodec::onMessage, &codec, _1, _2, _3));
+// @endcode
+class LengthHeaderCodec : public LengthHeaderFramer {
+ public:
+  // 'frame' lives until the callback returns.
+  typedef boost::function<void (const TcpConnectionPtr& conn,
+                                const StringPiece& frame,
+                                Timestamp receiveTime)> FrameCb;
+  // Called before closing the connection on a bad header, 'length' is
+  // the length announced, 0 for a malformed varint.
+  typedef boost::function<void (const TcpConnectionPtr& conn,
+                                size_t length)> FrameErrorCb;
+
+  LengthHeaderCodec(HeaderType type,
+                    const FrameCb& cb,
+                    size_t maxFrameSize = kDefaultMaxFrameSize);
+
+  void setFrameErrorCb(const FrameErrorCb& cb) { frameErrorCb_ = cb; }
+
+  // The message callback of the connections.
+  void onMessage(const TcpConnectionPtr& conn,
+                 Buffer* buffer,
+                 Timestamp receiveTime);
+
+  // Sends the content of 'buffer' as a frame, without a copy from the
+  // loop thread, @see TcpConnection::send(Buffer*).
+  // @return false if it's larger than the max frame size, nothing is
+  // sent then
+  bool send(const TcpConnectionPtr& conn, Buffer* buffer) const;
+  bool send(const TcpConnectionPtr& conn, const StringPiece& frame) const;
+
+ private:
+  void frameError(const TcpConnectionPtr& conn,
+                  Buffer* buffer,
+                  size_t length);
+
+  FrameCb frameCb_;
+  FrameErrorCb frameErrorCb_;
+
+  DISABLE_COPY_AND_ASSIGN(LengthHeaderCodec);
+};
+
+}  // namespace cobra
+
+#endif  // COBRA_LENGTH_HEADER_CODEC_H_
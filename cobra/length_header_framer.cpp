@@ -0,0 +1,116 @@
+#include "cobra/length_header_framer.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+
+#include "cobra/endian.h"
+
+namespace cobra {
+
+const size_t LengthHeaderFramer::kDefaultMaxFrameSize;
+const size_t LengthHeaderFramer::kMaxInt16FrameSize;
+const size_t LengthHeaderFramer::kMaxHeaderSize;
+
+LengthHeaderFramer::LengthHeaderFramer(HeaderType type, size_t maxFrameSize)
+  : type_(type),
+    maxFrameSize_(type == kInt16
+                  ? std::min(maxFrameSize, kMaxInt16FrameSize)
+                  : maxFrameSize) {
+  // Frames are handed out as StringPiece.
+  assert(maxFrameSize_ <= static_cast<size_t>(std::numeric_limits<int>::max()));
+}
+
+bool LengthHeaderFramer::encode(Buffer* buffer) const {
+  const size_t frameLen = buffer->readableBytes();
+  if (frameLen > maxFrameSize_) {
+    // The header couldn't tell its length, or the peer would drop it.
+    return false;
+  }
+  char header[kMaxHeaderSize];
+  const size_t headerLen = encodeHeader(frameLen, header);
+  if (buffer->prependableBytes() < headerLen) {
+    // Someone used the prepend space already, a copy then.
+    Buffer framed;
+    framed.append(header, headerLen);
+    framed.append(buffer->BeginRead(), frameLen);
+    buffer->swap(framed);
+    return true;
+  }
+  buffer->prepend(header, headerLen);
+  return true;
+}
+
+int LengthHeaderFramer::decodeHeader(const char* data,
+                                     size_t len,
+                                     size_t* frameLen) const {
+  switch (type_) {
+    case kInt16: {
+      if (len < sizeof(uint16)) {
+        return 0;
+      }
+      uint16 be16 = 0;
+      ::memcpy(&be16, data, sizeof be16);
+      *frameLen = networkToHost16(be16);
+      return static_cast<int>(sizeof be16);
+    }
+    case kInt32: {
+      if (len < sizeof(uint32)) {
+        return 0;
+      }
+      uint32 be32 = 0;
+      ::memcpy(&be32, data, sizeof be32);
+      *frameLen = networkToHost32(be32);
+      return static_cast<int>(sizeof be32);
+    }
+    case kVarint:
+    default: {
+      const size_t n = std::min(len, kMaxHeaderSize);
+      uint32 value = 0;
+      for (size_t i = 0; i < n; ++i) {
+        const uint8 byte = static_cast<uint8>(data[i]);
+        if (i == kMaxHeaderSize - 1 && byte > 0x0f) {
+          // More than 32 bits.
+          return -1;
+        }
+        value |= static_cast<uint32>(byte & 0x7f) << (7 * i);
+        if ((byte & 0x80) == 0) {
+          *frameLen = value;
+          return static_cast<int>(i + 1);
+        }
+      }
+      return n < kMaxHeaderSize ? 0 : -1;
+    }
+  }
+}
+
+size_t LengthHeaderFramer::encodeHeader(size_t frameLen, char* header) const {
+  switch (type_) {
+    case kInt16: {
+      assert(frameLen <= kMaxInt16FrameSize);
+      const uint16 be16 = hostToNetwork16(static_cast<uint16>(frameLen));
+      ::memcpy(header, &be16, sizeof be16);
+      return sizeof be16;
+    }
+    case kInt32: {
+      const uint32 be32 = hostToNetwork32(static_cast<uint32>(frameLen));
+      ::memcpy(header, &be32, sizeof be32);
+      return sizeof be32;
+    }
+    case kVarint:
+    default: {
+      uint32 value = static_cast<uint32>(frameLen);
+      size_t n = 0;
+      while (value >= 0x80) {
+        header[n++] = static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+      }
+      header[n++] = static_cast<char>(value);
+      return n;
+    }
+  }
+}
+
+}  // namespace cobra
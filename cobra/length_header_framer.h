@@ -0,0 +1,102 @@
+// Author: Jianbo Zhu
+//
+// Length header framing of byte streams, with no connection attached.
+
+#ifndef COBRA_LENGTH_HEADER_FRAMER_H_
+#define COBRA_LENGTH_HEADER_FRAMER_H_
+
+#include "base/basic_types.h"
+#include "base/string_piece.h"
+#include "cobra/buffer.h"
+
+namespace cobra {
+
+// The framing of LengthHeaderCodec: splits a buffer into frames, each
+// preceded by its length, and frames a buffer likewise. Knows nothing
+// of connections nor logging, @see LengthHeaderCodec for these.
+class LengthHeaderFramer {
+ public:
+  enum HeaderType {
+    // 16 bits, network byte order.
+    kInt16,
+    // 32 bits, network byte order.
+    kInt32,
+    // Base 128 varint, 7 bits a byte, least significant first, as in
+    // protobuf. 1 byte for frames up to 127 bytes, 5 at most.
+    kVarint
+  };
+
+  static const size_t kDefaultMaxFrameSize = 16 * 1024 * 1024;
+  // What a kInt16 header can announce, a larger max frame size is
+  // capped to it.
+  static const size_t kMaxInt16FrameSize = 0xffff;
+  // The longest header, a 32 bits varint.
+  static const size_t kMaxHeaderSize = 5;
+
+  explicit LengthHeaderFramer(HeaderType type,
+                              size_t maxFrameSize = kDefaultMaxFrameSize);
+
+  // Hands the complete frames at the front of 'buffer' to 'cb', as
+  // cb(const StringPiece& frame), in place, and retrieves them. An
+  // incomplete frame is left in 'buffer' for the next call.
+  //
+  // A template so the callback is inlined, it runs once a frame.
+  //
+  // @return false on a header announcing more than the max frame size or
+  // malformed, it's left at the front of 'buffer' and the length it
+  // announces stored in 'badLength', 0 for a malformed varint
+  template <typename FrameCb>
+  bool decode(Buffer* buffer, FrameCb& cb, size_t* badLength) const;
+
+  // Turns the content of 'buffer' into a frame, writing the header into
+  // the prepend space, @see Buffer::kCheapPrepend.
+  // @return false if it's larger than the max frame size, 'buffer' is
+  // left as is then
+  bool encode(Buffer* buffer) const;
+
+  HeaderType headerType() const { return type_; }
+  size_t maxFrameSize() const { return maxFrameSize_; }
+
+ private:
+  // Reads the header at 'data'.
+  // @return the header size and stores the frame length, 0 if the header
+  // isn't complete yet, -1 if it's malformed
+  int decodeHeader(const char* data, size_t len, size_t* frameLen) const;
+  // Writes the header of a 'frameLen' bytes frame to 'header'.
+  // @return the header size
+  size_t encodeHeader(size_t frameLen, char* header) const;
+
+  HeaderType type_;
+  size_t maxFrameSize_;
+};
+
+template <typename FrameCb>
+bool LengthHeaderFramer::decode(Buffer* buffer,
+                                FrameCb& cb,
+                                size_t* badLength) const {
+  while (buffer->readableBytes() > 0) {
+    size_t frameLen = 0;
+    const int header = decodeHeader(buffer->BeginRead(),
+                                    buffer->readableBytes(),
+                                    &frameLen);
+    if (header == 0) {
+      break;
+    }
+    if (header < 0 || frameLen > maxFrameSize_) {
+      *badLength = header < 0 ? 0 : frameLen;
+      return false;
+    }
+    const size_t total = static_cast<size_t>(header) + frameLen;
+    if (buffer->readableBytes() < total) {
+      break;
+    }
+
+    cb(StringPiece(buffer->BeginRead() + header, static_cast<int>(frameLen)));
+    buffer->retrieve(total);
+  }
+  return true;
+}
+
+}  // namespace cobra
+
+#endif  // COBRA_LENGTH_HEADER_FRAMER_H_
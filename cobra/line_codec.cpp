@@ -0,0 +1,67 @@
+#include "cobra/line_codec.h"
+
+#include "base/Logging.h"
+#include "cobra/tcp_connection.h"
+
+namespace cobra {
+
+const size_t LineCodec::kDefaultMaxLineSize;
+
+LineCodec::LineCodec(Delimiter type,
+                     const LineCb& cb,
+                     char delimiter,
+                     size_t maxLineSize)
+  : type_(type),
+    delimiter_(delimiter),
+    delimiterSize_(type == kCRLF ? 2 : 1),
+    maxLineSize_(maxLineSize),
+    lineCb_(cb) {
+}
+
+void LineCodec::onMessage(const TcpConnectionPtr& conn,
+                          Buffer* buffer,
+                          Timestamp receiveTime) {
+  // Resume where the last scan stopped, a byte earlier for "\r\n" as the
+  // '\r' may have been the last byte then.
+  size_t skip = buffer->scannedBytes();
+  if (skip > 0) {
+    skip -= delimiterSize_ - 1;
+  }
+
+  while (buffer->readableBytes() > 0) {
+    const char* begin = buffer->BeginRead();
+    const char* end = buffer->BeginWrite();
+    const char* eol = findDelimiter(begin + skip, end);
+    if (eol == NULL) {
+      if (buffer->readableBytes() > maxLineSize_) {
+        LOG_ERROR << "LineCodec - " << conn->name() << " line longer than "
+                  << maxLineSize_ << " bytes";
+        buffer->retrieveAll();
+        conn->forceClose();
+        return;
+      }
+      buffer->setScannedBytes(buffer->readableBytes());
+      return;
+    }
+
+    lineCb_(conn,
+            StringPiece(begin, static_cast<int>(eol - begin)),
+            receiveTime);
+    buffer->retrieveUntil(eol + delimiterSize_);
+    skip = 0;
+  }
+}
+
+void LineCodec::send(const TcpConnectionPtr& conn,
+                     const StringPiece& line) const {
+  Buffer buffer;
+  buffer.append(line);
+  if (type_ == kCRLF) {
+    buffer.append("\r\n", 2);
+  } else {
+    buffer.append(&delimiter_, 1);
+  }
+  conn->send(&buffer);
+}
+
+}  // namespace cobra
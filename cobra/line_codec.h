@@ -0,0 +1,83 @@
+// Author: Jianbo Zhu
+//
+// Lines of text protocols.
+
+#ifndef COBRA_LINE_CODEC_H_
+#define COBRA_LINE_CODEC_H_
+
+#include <boost/function.hpp>
+
+#include "base/basic_types.h"
+#include "base/macros.h"
+#include "base/string_piece.h"
+#include "base/timestamp.h"
+#include "cobra/buffer.h"
+#include "cobra/callbacks.h"
+
+namespace cobra {
+
+// Splits the input of a connection into lines ending with "\r\n" or a
+// single byte delimiter, '\n' usually.
+//
+// Every complete line of a read is handed out in one pass over the
+// input buffer, as views into it with no copy. What is left, a partial
+// line, is not scanned again as more of it comes in, the buffer keeps
+// track of where the scan stopped, @see Buffer::scannedBytes. A line
+// growing past the max line size closes the connection.
+//
+// @code
+// LineCodec codec(LineCodec::kCRLF, onLine);
+// server.SetMessageCb(
+//     boost::bind(&LineCodec::onMessage, &codec, _1, _2, _3));
+// @endcode
+class LineCodec {
+ public:
+  enum Delimiter {
+    // "\r\n", @see findCRLF.
+    kCRLF,
+    // A single byte, @see findByte.
+    kByte
+  };
+
+  // 'line' doesn't include the delimiter, it lives until the callback
+  // returns.
+  typedef boost::function<void (const TcpConnectionPtr& conn,
+                                const StringPiece& line,
+                                Timestamp receiveTime)> LineCb;
+
+  static const size_t kDefaultMaxLineSize = 64 * 1024;
+
+  // Lines ending with "\r\n" for kCRLF, with 'delimiter' for kByte.
+  LineCodec(Delimiter type,
+            const LineCb& cb,
+            char delimiter = '\n',
+            size_t maxLineSize = kDefaultMaxLineSize);
+
+  // The message callback of the connections.
+  void onMessage(const TcpConnectionPtr& conn,
+                 Buffer* buffer,
+                 Timestamp receiveTime);
+
+  // Sends 'line' followed by the delimiter.
+  void send(const TcpConnectionPtr& conn, const StringPiece& line) const;
+
+ private:
+  // The first delimiter in [start, end), NULL if none.
+  const char* findDelimiter(const char* start, const char* end) const {
+    return type_ == kCRLF ? findCRLF(start, end)
+                          : findByte(start, end, delimiter_);
+  }
+
+  const Delimiter type_;
+  const char delimiter_;
+  // 2 for "\r\n", 1 otherwise.
+  const size_t delimiterSize_;
+  const size_t maxLineSize_;
+  LineCb lineCb_;
+
+  DISABLE_COPY_AND_ASSIGN(LineCodec);
+};
+
+}  // namespace cobra
+
+#endif  // COBRA_LINE_CODEC_H_
@@ -0,0 +1,323 @@
+#include "cobra/load_balancer.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <boost/bind.hpp>
+
+#include "base/Logging.h"
+
+namespace cobra {
+
+namespace {
+
+// FNV-1a, to place the virtual nodes.
+uint32 hashString(const string& str) {
+  uint32 h = 2166136261u;
+  for (size_t i = 0; i < str.size(); ++i) {
+    h ^= static_cast<unsigned char>(str[i]);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// The finalizer of MurmurHash3, spreads keys and counters alike.
+uint64 mix64(uint64 k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+}  // Anonymous namespace
+
+const int LoadBalancer::kEjectFailures;
+const int LoadBalancer::kInitEjectMs;
+const int LoadBalancer::kMaxEjectMs;
+const int LoadBalancer::kVirtualNodes;
+const int LoadBalancer::kLatencyDecay;
+
+LoadBalancer::LoadBalancer(const std::vector<Worker*>& loops,
+                           const std::vector<Endpoint>& endpoints,
+                           const string& name,
+                           int connectionsPerEndpoint)
+  : endpoints_(endpoints),
+    name_(name),
+    policy_(kLeastOutstanding),
+    started_(false) {
+  assert(!endpoints_.empty());
+  for (size_t i = 0; i < endpoints_.size(); ++i) {
+    Backend* backend = new Backend;
+    backend->index = i;
+    backend->pool.reset(
+        new ClientPool(loops, endpoints_[i],
+                       name_ + ":" + endpoints_[i].toIpPort(),
+                       connectionsPerEndpoint));
+    backend->ejectMs.getAndSet(kInitEjectMs);
+    backends_.push_back(backend);
+  }
+}
+
+LoadBalancer::~LoadBalancer() {
+  // The pools fail what's in flight, our callbacks need the backends.
+  for (size_t i = 0; i < backends_.size(); ++i) {
+    backends_[i].pool.reset();
+  }
+}
+
+void LoadBalancer::setResponseLengthCb(const ResponseLengthCb& cb) {
+  for (size_t i = 0; i < backends_.size(); ++i) {
+    backends_[i].pool->setResponseLengthCb(cb);
+  }
+}
+
+void LoadBalancer::setMaxPipeline(int n) {
+  for (size_t i = 0; i < backends_.size(); ++i) {
+    backends_[i].pool->setMaxPipeline(n);
+  }
+}
+
+void LoadBalancer::setMaxInFlight(int n) {
+  for (size_t i = 0; i < backends_.size(); ++i) {
+    backends_[i].pool->setMaxInFlight(n);
+  }
+}
+
+void LoadBalancer::setConnectTimeout(double seconds) {
+  for (size_t i = 0; i < backends_.size(); ++i) {
+    backends_[i].pool->setConnectTimeout(seconds);
+  }
+}
+
+void LoadBalancer::setAutoCork(bool on) {
+  for (size_t i = 0; i < backends_.size(); ++i) {
+    backends_[i].pool->setAutoCork(on);
+  }
+}
+
+void LoadBalancer::start() {
+  if (started_) {
+    return;
+  }
+
+  if (policy_ == kConsistentHash) {
+    ring_.reserve(backends_.size() * kVirtualNodes);
+    for (size_t i = 0; i < backends_.size(); ++i) {
+      // Placed by address, so the ring doesn't depend on the order of
+      // the endpoints.
+      const string addr = endpoints_[i].toIpPort();
+      for (int v = 0; v < kVirtualNodes; ++v) {
+        char buf[16];
+        snprintf(buf, sizeof buf, "#%d", v);
+        ring_.push_back(std::make_pair(hashString(addr + buf),
+                                       static_cast<uint32>(i)));
+      }
+    }
+    std::sort(ring_.begin(), ring_.end());
+  }
+
+  for (size_t i = 0; i < backends_.size(); ++i) {
+    backends_[i].pool->start();
+  }
+  started_ = true;
+}
+
+bool LoadBalancer::call(uint64 key,
+                        const StringPiece& request,
+                        const ResponseCb& cb) {
+  const Timestamp now = Timestamp::now();
+  if (ejected_.get() > 0) {
+    int64 due = 0;
+    Backend* probe = claimProbe(now.microSecondsSinceEpoch(), &due);
+    if (probe != NULL) {
+      if (callBackend(probe, true, now, request, cb)) {
+        return true;
+      }
+      // No probe went out, give the claim back so the next call probes,
+      // rather than leaving the backend out for another period.
+      probe->ejectedUntil.getAndSet(due);
+    }
+  }
+
+  Backend* first = pick(key);
+  if (first == NULL) {
+    return false;
+  }
+  if (callBackend(first, false, now, request, cb)) {
+    return true;
+  }
+
+  // Full, or lost its connections meanwhile, any other will do.
+  const size_t n = backends_.size();
+  for (size_t i = 1; i < n; ++i) {
+    Backend* backend = &backends_[(first->index + i) % n];
+    if (available(backend)
+        && callBackend(backend, false, now, request, cb)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool LoadBalancer::callBackend(Backend* backend,
+                               bool probe,
+                               Timestamp sent,
+                               const StringPiece& request,
+                               const ResponseCb& cb) {
+  return backend->pool->call(
+      request,
+      boost::bind(&LoadBalancer::onResponse, this,
+                  backend, probe, sent, cb, _1, _2));
+}
+
+LoadBalancer::Backend* LoadBalancer::claimProbe(int64 now, int64* due) {
+  for (size_t i = 0; i < backends_.size(); ++i) {
+    Backend* backend = &backends_[i];
+    const int64 until = backend->ejectedUntil.get();
+    if (until == 0 || until > now
+        || backend->pool->connectedCount() == 0) {
+      continue;
+    }
+    // Pushing the deadline back, so only the first caller probes. If the
+    // probe gets lost, another one goes then.
+    const int64 next =
+        now + static_cast<int64>(backend->ejectMs.get()) * 1000;
+    if (backend->ejectedUntil.getAndSet(next) == until) {
+      *due = until;
+      LOG_INFO << "LoadBalancer [" << name_ << "] - probing "
+               << backend->pool->name();
+      return backend;
+    }
+  }
+  return NULL;
+}
+
+LoadBalancer::Backend* LoadBalancer::pick(uint64 key) {
+  switch (policy_) {
+    case kConsistentHash:
+      return consistentHash(key);
+    case kPowerOfTwoChoices:
+      return powerOfTwoChoices();
+    case kLeastOutstanding:
+    default:
+      return leastOutstanding();
+  }
+}
+
+LoadBalancer::Backend* LoadBalancer::leastOutstanding() {
+  // Start anywhere, ties then don't all go to the first backend.
+  const size_t n = backends_.size();
+  const size_t start = static_cast<size_t>(random64() % n);
+  Backend* best = NULL;
+  int32 least = 0;
+  for (size_t i = 0; i < n; ++i) {
+    Backend* backend = &backends_[(start + i) % n];
+    if (!available(backend)) {
+      continue;
+    }
+    const int32 inFlight = backend->pool->inFlight();
+    if (best == NULL || inFlight < least) {
+      best = backend;
+      least = inFlight;
+    }
+  }
+  return best;
+}
+
+LoadBalancer::Backend* LoadBalancer::consistentHash(uint64 key) {
+  assert(!ring_.empty());
+  const uint32 h = static_cast<uint32>(mix64(key) >> 32);
+  std::vector<std::pair<uint32, uint32> >::const_iterator it =
+      std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(h, 0u));
+  // Clockwise to the first backend available.
+  for (size_t i = 0; i < ring_.size(); ++i, ++it) {
+    if (it == ring_.end()) {
+      it = ring_.begin();
+    }
+    Backend* backend = &backends_[it->second];
+    if (available(backend)) {
+      return backend;
+    }
+  }
+  return NULL;
+}
+
+LoadBalancer::Backend* LoadBalancer::powerOfTwoChoices() {
+  const size_t n = backends_.size();
+  if (n == 1) {
+    return available(&backends_[0]) ? &backends_[0] : NULL;
+  }
+  // Two different ones.
+  const uint64 r = random64();
+  const size_t i = static_cast<size_t>(r % n);
+  const size_t j = (i + 1 + static_cast<size_t>((r >> 32) % (n - 1))) % n;
+  Backend* a = &backends_[i];
+  Backend* b = &backends_[j];
+  if (!available(a)) {
+    std::swap(a, b);
+  }
+  if (!available(a)) {
+    // Both out, the least loaded of the others then.
+    return leastOutstanding();
+  }
+  if (!available(b)) {
+    return a;
+  }
+
+  // +1, so that an idle backend or one not measured yet still compares.
+  const int64 costA = (a->latencyUs.get() + 1) * (a->pool->inFlight() + 1);
+  const int64 costB = (b->latencyUs.get() + 1) * (b->pool->inFlight() + 1);
+  return costA <= costB ? a : b;
+}
+
+void LoadBalancer::onResponse(Backend* backend,
+                              bool probe,
+                              Timestamp sent,
+                              const ResponseCb& cb,
+                              bool ok,
+                              const StringPiece& response) {
+  const Timestamp now = Timestamp::now();
+  if (ok) {
+    const int64 sample =
+        now.microSecondsSinceEpoch() - sent.microSecondsSinceEpoch();
+    const int64 average = backend->latencyUs.get();
+    backend->latencyUs.getAndSet(
+        average == 0 ? sample : average + (sample - average) / kLatencyDecay);
+    backend->failures.getAndSet(0);
+    if (probe) {
+      LOG_INFO << "LoadBalancer [" << name_ << "] - "
+               << backend->pool->name() << " is back";
+      backend->ejectMs.getAndSet(kInitEjectMs);
+      backend->ejectedUntil.getAndSet(0);
+      ejected_.decrement();
+    }
+  } else if (probe) {
+    // Still failing, longer this time.
+    const int32 ms = backend->ejectMs.get();
+    backend->ejectMs.getAndSet(std::min(ms * 2, kMaxEjectMs));
+    eject(backend, now.microSecondsSinceEpoch());
+  } else if (backend->ejectedUntil.get() == 0
+             && backend->failures.incrementAndGet() == kEjectFailures) {
+    // Requests sent before the ejection don't count once it's done.
+    ejected_.increment();
+    eject(backend, now.microSecondsSinceEpoch());
+  }
+  cb(ok, response);
+}
+
+void LoadBalancer::eject(Backend* backend, int64 now) {
+  const int32 ms = backend->ejectMs.get();
+  backend->ejectedUntil.getAndSet(now + static_cast<int64>(ms) * 1000);
+  backend->failures.getAndSet(0);
+  ejections_.increment();
+  LOG_WARN << "LoadBalancer [" << name_ << "] - ejecting "
+           << backend->pool->name() << " for " << ms << " milliseconds";
+}
+
+uint64 LoadBalancer::random64() {
+  return mix64(static_cast<uint64>(draws_.incrementAndGet()));
+}
+
+}  // namespace cobra
@@ -0,0 +1,173 @@
+// Author: Jianbo Zhu
+//
+// Client side load balancing over several backends.
+
+#ifndef COBRA_LOAD_BALANCER_H_
+#define COBRA_LOAD_BALANCER_H_
+
+#include <utility>
+#include <vector>
+
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "base/Atomic.h"
+#include "base/basic_types.h"
+#include "base/macros.h"
+#include "base/timestamp.h"
+#include "cobra/client_pool.h"
+#include "cobra/endpoint.h"
+
+namespace cobra {
+
+// Routes requests over the backends of a list of endpoints, one
+// ClientPool each.
+//
+// A backend failing kEjectFailures requests in a row is ejected: it gets
+// no requests for a while, then a single one probes it. A successful
+// probe brings it back, a failed one ejects it again for twice as long,
+// up to kMaxEjectMs. A backend with no connection up is skipped until
+// its TcpClients reconnect, @see Connector::retry.
+//
+// Everything but the setters is thread safe, picking a backend only
+// reads atomic counters.
+class LoadBalancer {
+ public:
+  typedef ClientPool::ResponseLengthCb ResponseLengthCb;
+  typedef ClientPool::ResponseCb ResponseCb;
+
+  // How call picks a backend among the ones not ejected.
+  enum Policy {
+    // The one with the fewest requests in flight.
+    kLeastOutstanding,
+    // Where the key of the request falls on a ring of virtual nodes, the
+    // same key then goes to the same backend while it's up, and only
+    // the keys of a backend going down move.
+    kConsistentHash,
+    // The cheaper of two backends drawn at random, the cost being the
+    // response latency (moving average) times the requests in flight.
+    // Steers away from slow backends without herding on the fastest.
+    kPowerOfTwoChoices
+  };
+
+  static const int kEjectFailures = 5;
+  static const int kInitEjectMs = 1000;
+  static const int kMaxEjectMs = 30000;
+  // Points of each backend on the consistent hash ring.
+  static const int kVirtualNodes = 100;
+
+  // Pools of 'connectionsPerEndpoint' connections, @see ClientPool.
+  LoadBalancer(const std::vector<Worker*>& loops,
+               const std::vector<Endpoint>& endpoints,
+               const string& name,
+               int connectionsPerEndpoint);
+  // @see ClientPool::~ClientPool.
+  ~LoadBalancer();
+
+  // kLeastOutstanding by default.
+  // Must be called before @c start.
+  void setPolicy(Policy policy) { policy_ = policy; }
+
+  // Apply to the pool of each backend, @see ClientPool.
+  // Must be called before @c start.
+  void setResponseLengthCb(const ResponseLengthCb& cb);
+  void setMaxPipeline(int n);
+  // Per backend.
+  void setMaxInFlight(int n);
+  void setConnectTimeout(double seconds);
+  void setAutoCork(bool on);
+
+  void start();
+
+  // Sends 'request' to a backend picked by the policy, or to the next
+  // one able to take it if that one is full. 'cb' runs in the loop of
+  // the connection.
+  // @return false if no backend took it, 'cb' is not called then.
+  bool call(const StringPiece& request, const ResponseCb& cb) {
+    return call(random64(), request, cb);
+  }
+  // With the key for kConsistentHash, other policies ignore it.
+  bool call(uint64 key, const StringPiece& request, const ResponseCb& cb);
+
+  size_t backendCount() const { return backends_.size(); }
+  ClientPool* backend(size_t i) { return get_pointer(backends_[i].pool); }
+
+  ////////////////////// begin /////////////////////////////////
+  // The backends ejected now.
+  int32 ejectedCount() { return ejected_.get(); }
+  // How many times a backend was ejected.
+  int64 ejections() { return ejections_.get(); }
+  // Moving average of the response latency of backend 'i'.
+  int64 latencyUs(size_t i) { return backends_[i].latencyUs.get(); }
+  ///////////////////////// end ///////////////////////////////
+
+ private:
+  struct Backend {
+    // In backends_.
+    size_t index;
+    boost::scoped_ptr<ClientPool> pool;
+    // Exponentially weighted, updates racing each other may lose one
+    // sample, which doesn't matter for an average.
+    AtomicInt64 latencyUs;
+    // Failed requests in a row.
+    AtomicInt32 failures;
+    // Microseconds since epoch, 0 if not ejected, still set while the
+    // probe is out.
+    AtomicInt64 ejectedUntil;
+    AtomicInt32 ejectMs;
+  };
+
+  // Weight of a new latency sample is 1 / kLatencyDecay.
+  static const int kLatencyDecay = 8;
+
+  // Not ejected, and connected.
+  bool available(Backend* backend) {
+    return backend->ejectedUntil.get() == 0
+           && backend->pool->connectedCount() > 0;
+  }
+
+  // An ejected backend due for a probe, claimed by the caller, which
+  // restores its ejectedUntil to '*due' if the probe can't be sent.
+  // @return NULL if none
+  Backend* claimProbe(int64 now, int64* due);
+  // @return NULL if none is available
+  Backend* pick(uint64 key);
+  Backend* leastOutstanding();
+  Backend* consistentHash(uint64 key);
+  Backend* powerOfTwoChoices();
+
+  // Sends through the pool of 'backend', 'probe' if it's ejected.
+  bool callBackend(Backend* backend,
+                   bool probe,
+                   Timestamp sent,
+                   const StringPiece& request,
+                   const ResponseCb& cb);
+  void onResponse(Backend* backend,
+                  bool probe,
+                  Timestamp sent,
+                  const ResponseCb& cb,
+                  bool ok,
+                  const StringPiece& response);
+  void eject(Backend* backend, int64 now);
+
+  // Thread safe, a counter run through a mixing function.
+  uint64 random64();
+
+  const std::vector<Endpoint> endpoints_;
+  const string name_;
+  Policy policy_;
+  bool started_;
+  boost::ptr_vector<Backend> backends_;
+  // (hash, backend index) sorted by hash, @see kConsistentHash.
+  std::vector<std::pair<uint32, uint32> > ring_;
+
+  AtomicInt64 draws_;
+  AtomicInt32 ejected_;
+  AtomicInt64 ejections_;
+
+  DISABLE_COPY_AND_ASSIGN(LoadBalancer);
+};
+
+}  // namespace cobra
+
+#endif  // COBRA_LOAD_BALANCER_H_
@@ -0,0 +1,223 @@
+// Author: Jianbo Zhu
+//
+// An intrusive lock-free multi-producer/single-consumer queue.
+// Based on Dmitry Vyukov's intrusive MPSC node-based queue:
+// producers only do one atomic exchange on push, the consumer never
+// touches a shared atomic on the fast path.
+
+#ifndef COBRA_MPSC_QUEUE_H_
+#define COBRA_MPSC_QUEUE_H_
+
+#include <assert.h>
+
+#include <algorithm>
+
+#include "base/basic_types.h"
+#include "base/macros.h"
+
+namespace cobra {
+
+// Nodes are carved out of fixed-size chunks owned by the queue and
+// recycled through a free list, so a steady-state push allocates nothing.
+// The free list is addressed by (tag, index) pairs packed into 64 bits
+// which keeps the pop side free of ABA problems without a double-width CAS.
+//
+// push() is safe to call from any thread, pop() must only be called from
+// the consumer thread.
+template <typename T>
+class MpscQueue {
+ public:
+  MpscQueue()
+    : head_(&stub_),
+      tail_(&stub_),
+      freeList_(kNoIndex),
+      numChunks_(0) {
+    stub_.next = NULL;
+    stub_.index = kNoIndex;
+    for (uint32 i = 0; i < kMaxChunks; ++i) {
+      chunks_[i] = NULL;
+    }
+  }
+
+  ~MpscQueue() {
+    T value = T();
+    while (pop(&value)) {
+    }
+    for (uint32 i = 0; i < kMaxChunks; ++i) {
+      delete[] chunks_[i];
+    }
+  }
+
+  // Pushes a copy of 'value'.
+  // Thread safe.
+  void push(const T& value) {
+    Node* node = allocNode();
+    node->value = value;
+    node->next = NULL;
+    Node* prev = __atomic_exchange_n(&head_, node, __ATOMIC_ACQ_REL);
+    // The queue is "broken" between the exchange and the store below,
+    // the consumer sees it as empty and will be woken up again.
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+  }
+
+  // Pops the oldest element into '*value'.
+  // Returns false if the queue is empty or the newest push has not
+  // finished linking yet.
+  // Must be called by the consumer.
+  bool pop(T* value) {
+    Node* tail = tail_;
+    Node* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &stub_) {
+      if (next == NULL) {
+        return false;
+      }
+      tail_ = next;
+      tail = next;
+      next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next == NULL) {
+      if (tail != __atomic_load_n(&head_, __ATOMIC_ACQUIRE)) {
+        return false;
+      }
+      // 'tail' is the last node, put the stub behind it so it can go.
+      stub_.next = NULL;
+      Node* prev = __atomic_exchange_n(&head_, &stub_, __ATOMIC_ACQ_REL);
+      __atomic_store_n(&prev->next, &stub_, __ATOMIC_RELEASE);
+      next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+      if (next == NULL) {
+        return false;
+      }
+    }
+
+    tail_ = next;
+    // Swap instead of copy, so whatever the value holds is released
+    // as soon as the caller is done with it.
+    swapValue(value, &tail->value);
+    freeNode(tail);
+    return true;
+  }
+
+  // Must be called by the consumer.
+  bool empty() const {
+    return tail_ == &stub_ &&
+           __atomic_load_n(&stub_.next, __ATOMIC_ACQUIRE) == NULL;
+  }
+
+ private:
+  static const uint32 kNoIndex = 0xffffffff;
+  // 256 nodes per chunk, 4096 chunks: one million in-flight elements
+  // before we fall back to plain heap nodes.
+  static const uint32 kChunkShift = 8;
+  static const uint32 kChunkSize = 1 << kChunkShift;
+  static const uint32 kMaxChunks = 4096;
+
+  struct Node {
+    Node* next;
+    // The slot of this node in 'chunks_', kNoIndex for heap nodes.
+    uint32 index;
+    // Next slot in the free list.
+    uint32 freeNext;
+    T value;
+  };
+
+  static void swapValue(T* lhs, T* rhs) {
+    using std::swap;
+    swap(*lhs, *rhs);
+  }
+
+  static uint64 pack(uint64 tag, uint32 index) {
+    return (tag << 32) | index;
+  }
+
+  Node* nodeAt(uint32 index) const {
+    return &chunks_[index >> kChunkShift][index & (kChunkSize - 1)];
+  }
+
+  Node* allocNode() {
+    for (;;) {
+      uint64 old = __atomic_load_n(&freeList_, __ATOMIC_ACQUIRE);
+      uint32 index = static_cast<uint32>(old);
+      if (index == kNoIndex) {
+        break;
+      }
+      Node* node = nodeAt(index);
+      // 'freeNext' may be stale if someone popped this node meanwhile,
+      // the tag makes the CAS below fail in that case.
+      uint64 next = pack((old >> 32) + 1, node->freeNext);
+      if (__sync_bool_compare_and_swap(&freeList_, old, next)) {
+        return node;
+      }
+    }
+
+    return newChunk();
+  }
+
+  // Allocates a new chunk, keeps its first node and donates the rest
+  // to the free list.
+  Node* newChunk() {
+    // Only counts up to kMaxChunks, past it every push would add one
+    // and it would wrap around to the chunks in use.
+    uint32 c = __atomic_load_n(&numChunks_, __ATOMIC_RELAXED);
+    for (;;) {
+      if (c >= kMaxChunks) {
+        Node* node = new Node;
+        node->index = kNoIndex;
+        return node;
+      }
+      const uint32 seen = __sync_val_compare_and_swap(&numChunks_, c, c + 1);
+      if (seen == c) {
+        break;
+      }
+      c = seen;
+    }
+
+    Node* chunk = new Node[kChunkSize];
+    for (uint32 i = 0; i < kChunkSize; ++i) {
+      chunk[i].index = (c << kChunkShift) | i;
+      chunk[i].freeNext = chunk[i].index + 1;
+    }
+    __atomic_store_n(&chunks_[c], chunk, __ATOMIC_RELEASE);
+    pushFree(&chunk[1], &chunk[kChunkSize - 1]);
+    return &chunk[0];
+  }
+
+  void freeNode(Node* node) {
+    if (node->index == kNoIndex) {
+      delete node;
+    } else {
+      pushFree(node, node);
+    }
+  }
+
+  // Pushes the chain [first, last], already linked through 'freeNext'.
+  void pushFree(Node* first, Node* last) {
+    for (;;) {
+      uint64 old = __atomic_load_n(&freeList_, __ATOMIC_ACQUIRE);
+      last->freeNext = static_cast<uint32>(old);
+      if (__sync_bool_compare_and_swap(&freeList_, old,
+                                       pack((old >> 32) + 1, first->index))) {
+        return;
+      }
+    }
+  }
+
+  // Producers side, kept away from the consumer side by padding.
+  Node* head_;
+  char pad0_[64 - sizeof(Node*)];
+
+  // Consumer side.
+  Node* tail_;
+  Node stub_;
+  char pad1_[64];
+
+  uint64 freeList_;
+  uint32 numChunks_;
+  Node* chunks_[kMaxChunks];
+
+  DISABLE_COPY_AND_ASSIGN(MpscQueue);
+};
+
+}  // namespace cobra
+
+#endif  // COBRA_MPSC_QUEUE_H_
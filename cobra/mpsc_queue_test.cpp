@@ -0,0 +1,187 @@
+// Author: Jianbo Zhu
+//
+// MpscQueue: order per producer, reuse of the nodes, and the heap
+// nodes past the chunks.
+
+#include "cobra/mpsc_queue.h"
+
+#include <stdlib.h>
+
+#include <new>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <gtest/gtest.h>
+
+namespace {
+
+// Allocations while counting, the queue allocates its chunks and heap
+// nodes with new.
+volatile bool g_counting = false;
+volatile int g_allocs = 0;
+
+}  // Anonymous namespace
+
+void* operator new(std::size_t size) {
+  if (g_counting) {
+    __sync_fetch_and_add(&g_allocs, 1);
+  }
+  void* p = ::malloc(size == 0 ? 1 : size);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](std::size_t size) {
+  return ::operator new(size);
+}
+
+#if __cplusplus >= 201103L
+#define COBRA_TEST_NOEXCEPT noexcept
+#else
+#define COBRA_TEST_NOEXCEPT throw()
+#endif
+
+// None is inlined, gcc would take the free() of what our new returns
+// for a mismatch.
+__attribute__((noinline))
+void operator delete(void* p) COBRA_TEST_NOEXCEPT {
+  ::free(p);
+}
+
+__attribute__((noinline))
+void operator delete[](void* p) COBRA_TEST_NOEXCEPT {
+  ::free(p);
+}
+
+__attribute__((noinline))
+void operator delete(void* p, std::size_t) COBRA_TEST_NOEXCEPT {
+  ::free(p);
+}
+
+__attribute__((noinline))
+void operator delete[](void* p, std::size_t) COBRA_TEST_NOEXCEPT {
+  ::free(p);
+}
+
+namespace cobra {
+namespace {
+
+// As in MpscQueue.
+const int kChunkSize = 256;
+const int kMaxChunks = 4096;
+
+class AllocCounter {
+ public:
+  AllocCounter() {
+    g_allocs = 0;
+    g_counting = true;
+  }
+
+  ~AllocCounter() {
+    g_counting = false;
+  }
+
+  int allocs() const { return g_allocs; }
+};
+
+// Pushes 'producer' << 32 | seq, seq from 0 to 'count' - 1.
+void produce(MpscQueue<int64>* queue, int64 producer, int count) {
+  for (int i = 0; i < count; ++i) {
+    queue->push((producer << 32) | i);
+  }
+}
+
+TEST(MpscQueueTest, FifoPerProducer) {
+  const int kProducers = 4;
+  const int kCount = 200000;
+  MpscQueue<int64> queue;
+
+  boost::thread_group producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.create_thread(boost::bind(&produce, &queue, p, kCount));
+  }
+
+  std::vector<int> next(kProducers, 0);
+  int popped = 0;
+  while (popped < kProducers * kCount) {
+    int64 value = 0;
+    if (!queue.pop(&value)) {
+      boost::this_thread::yield();
+      continue;
+    }
+    const int producer = static_cast<int>(value >> 32);
+    const int seq = static_cast<int>(value & 0xffffffff);
+    ASSERT_GE(producer, 0);
+    ASSERT_LT(producer, kProducers);
+    ASSERT_EQ(next[producer], seq);
+    ++next[producer];
+    ++popped;
+  }
+  producers.join_all();
+
+  int64 value = 0;
+  EXPECT_FALSE(queue.pop(&value));
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(MpscQueueTest, ReusesFreeNodes) {
+  MpscQueue<int> queue;
+  // Two chunks worth in flight.
+  const int kInFlight = 2 * kChunkSize;
+  for (int i = 0; i < kInFlight; ++i) {
+    queue.push(i);
+  }
+  int value = 0;
+  while (queue.pop(&value)) {
+  }
+
+  AllocCounter counter;
+  for (int round = 0; round < 100; ++round) {
+    for (int i = 0; i < kInFlight; ++i) {
+      queue.push(i);
+    }
+    for (int i = 0; i < kInFlight; ++i) {
+      ASSERT_TRUE(queue.pop(&value));
+      ASSERT_EQ(i, value);
+    }
+  }
+  EXPECT_EQ(0, counter.allocs());
+}
+
+TEST(MpscQueueTest, FallsBackToHeapNodes) {
+  MpscQueue<int> queue;
+  const int kChunked = kChunkSize * kMaxChunks;
+  const int kHeap = 1000;
+  {
+    AllocCounter counter;
+    for (int i = 0; i < kChunked + kHeap; ++i) {
+      queue.push(i);
+    }
+    // One per chunk, then one per node.
+    EXPECT_EQ(kMaxChunks + kHeap, counter.allocs());
+  }
+
+  int value = 0;
+  for (int i = 0; i < kChunked + kHeap; ++i) {
+    ASSERT_TRUE(queue.pop(&value));
+    ASSERT_EQ(i, value);
+  }
+  EXPECT_FALSE(queue.pop(&value));
+
+  // The chunks are all free again, the heap nodes are gone.
+  AllocCounter counter;
+  for (int i = 0; i < kChunked; ++i) {
+    queue.push(i);
+  }
+  EXPECT_EQ(0, counter.allocs());
+  for (int i = 0; i < kChunked; ++i) {
+    ASSERT_TRUE(queue.pop(&value));
+    ASSERT_EQ(i, value);
+  }
+}
+
+}  // Anonymous namespace
+}  // namespace cobra
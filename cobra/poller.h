@@ -4,12 +4,18 @@
 #ifndef COBRA_POLLER_H_
 #define COBRA_POLLER_H_
 
+#include <assert.h>
+
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
+
 #include "base/macros.h"
 #include "base/timestamp.h"
 #include "cobra/worker.h"
 
+struct iovec;
+
 namespace cobra {
 
 class Channel;
@@ -23,7 +29,7 @@ class Poller {
   Poller(Worker* loop) : ownerLoop_(loop) {
   }
 
-  virtual ~Poller();
+  virtual ~Poller() {}
 
   // Poll and Get active channels.
   //
@@ -39,6 +45,23 @@ class Poller {
   // Must be called in the loop thread.
   virtual void removeChannel(Channel* channel) = 0;
 
+  // Completion-based I/O: the poller receives from and sends to the
+  // channels itself, batched with the wait for events, instead of
+  // reporting them readable or writable, @see Channel::SetRecvDoneCb.
+  virtual bool completionIo() const { return false; }
+
+  // Sends 'iov' on the fd of 'channel', the result goes to its send done
+  // callback. The memory 'iov' points to must stay valid until then,
+  // 'owner' is held meanwhile, even once the channel is removed.
+  // Only if completionIo(), one send per channel at a time.
+  // Must be called in the loop thread.
+  virtual void submitSend(Channel* /*channel*/,
+                          const struct iovec* /*iov*/,
+                          int /*iovcnt*/,
+                          const boost::shared_ptr<void>& /*owner*/) {
+    assert(false);
+  }
+
   // @see poller/default_poller.cpp
   static Poller* newDefaultPoller(Worker* loop);
 
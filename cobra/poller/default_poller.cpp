@@ -1,6 +1,7 @@
 #include "cobra/poller.h"
 #include "cobra/poller/poll_poller.h"
 #include "cobra/poller/epoll_poller.h"
+#include "cobra/poller/io_uring_poller.h"
 
 #include <stdlib.h>
 
@@ -9,9 +10,17 @@ namespace cobra {
 Poller* Poller::newDefaultPoller(Worker* loop) {
   if (::getenv("COBRA_USE_POLL")) {
     return new PollPoller(loop);
-  } else {
-    return new EPollPoller(loop);
   }
+
+  if (::getenv("COBRA_USE_IO_URING")) {
+    // NULL if the kernel doesn't support it, use epoll then.
+    Poller* poller = IoUringPoller::create(loop);
+    if (poller) {
+      return poller;
+    }
+  }
+
+  return new EPollPoller(loop);
 }
 
 }  // namespace cobra
@@ -26,6 +26,9 @@ namespace
 const int kNew = -1;
 const int kAdded = 1;
 const int kDeleted = 2;
+
+// Edge-triggered channels are registered once with everything.
+const int kEdgeTriggeredEvents = EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLET;
 }
 
 EPollPoller::EPollPoller(Worker* loop)
@@ -129,8 +132,10 @@ void EPollPoller::UpdateChannel(Channel* channel) {
       update(EPOLL_CTL_DEL, channel);
       channel->set_index(kDeleted);
     }
-    else
+    else if (!channel->edgeTriggered())
     {
+      // Edge-triggered channels always wait for the same events,
+      // no need to modify.
       update(EPOLL_CTL_MOD, channel);
     }
   }
@@ -161,7 +166,8 @@ void EPollPoller::update(int operation, Channel* channel)
 {
   struct epoll_event event;
   bzero(&event, sizeof event);
-  event.events = channel->events();
+  event.events = channel->edgeTriggered() ? kEdgeTriggeredEvents
+                                          : channel->events();
   event.data.ptr = channel;
   int fd = channel->fd();
   if (::epoll_ctl(epollfd_, operation, fd, &event) < 0)
@@ -0,0 +1,631 @@
+#include "cobra/poller/io_uring_poller.h"
+
+#include <assert.h>
+#include <endian.h>
+#include <errno.h>
+#include <poll.h>
+#include <strings.h>  // bzero
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+#include <algorithm>
+
+#include <boost/static_assert.hpp>
+
+#include "base/Logging.h"
+#include "base/Types.h"
+#include "cobra/channel.h"
+
+using namespace cobra;
+
+namespace {
+
+// user_data of requests whose completion we don't care about.
+const uint64_t kIgnoreUserData = 0;
+
+// The low 2 bits of a tag are its Op.
+const uint32_t kOpMask = 3;
+
+// The buffer group of the receive buffers.
+const uint16_t kRecvBufferGroup = 0;
+
+// How many times, and for how long, the destructor waits for the
+// cancelled requests.
+const int kExitWaits = 10;
+const int kExitWaitMs = 100;
+
+uint64_t makeUserData(int fd, uint32_t tag) {
+  return (static_cast<uint64_t>(fd) << 32) | tag;
+}
+
+int ioUringSetup(unsigned entries, io_uring_params* params) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int ringfd, unsigned toSubmit, unsigned minComplete,
+                 unsigned flags, void* arg, size_t argsz) {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, ringfd, toSubmit,
+                                    minComplete, flags, arg, argsz));
+}
+
+}  // Anonymous namespace
+
+const unsigned IoUringPoller::kRecvBuffers;
+const size_t IoUringPoller::kRecvBufferSize;
+const int IoUringPoller::kMaxSendIovecs;
+const unsigned IoUringPoller::kMinBackoffUs;
+const unsigned IoUringPoller::kMaxBackoffUs;
+
+IoUringPoller* IoUringPoller::create(Worker* loop) {
+  IoUringPoller* poller = new IoUringPoller(loop);
+  if (!poller->setup()) {
+    delete poller;
+    return NULL;
+  }
+
+  return poller;
+}
+
+IoUringPoller::IoUringPoller(Worker* loop)
+  : Poller(loop),
+    ringfd_(-1),
+    sqRing_(MAP_FAILED),
+    sqRingSize_(0),
+    cqRing_(MAP_FAILED),
+    cqRingSize_(0),
+    sqes_(static_cast<io_uring_sqe*>(MAP_FAILED)),
+    sqesSize_(0),
+    sqHead_(NULL),
+    sqTail_(NULL),
+    sqMask_(0),
+    sqArray_(NULL),
+    cqHead_(NULL),
+    cqTail_(NULL),
+    cqMask_(0),
+    cqes_(NULL),
+    nextGeneration_(0),
+    completionIo_(false),
+    inflight_(0) {
+}
+
+IoUringPoller::~IoUringPoller() {
+  if (inflight_ > 0) {
+    drainOnExit();
+  }
+  if (sqes_ != MAP_FAILED) {
+    ::munmap(sqes_, sqesSize_);
+  }
+  if (cqRing_ != MAP_FAILED && cqRing_ != sqRing_) {
+    ::munmap(cqRing_, cqRingSize_);
+  }
+  if (sqRing_ != MAP_FAILED) {
+    ::munmap(sqRing_, sqRingSize_);
+  }
+  if (ringfd_ >= 0) {
+    ::close(ringfd_);
+  }
+}
+
+bool IoUringPoller::setup() {
+  io_uring_params params;
+  bzero(&params, sizeof params);
+  ringfd_ = ioUringSetup(kEntries, &params);
+  if (ringfd_ < 0) {
+    LOG_SYSERR << "IoUringPoller - io_uring_setup failed, falling back";
+    return false;
+  }
+
+  // EXT_ARG lets io_uring_enter wait with a timeout (5.11),
+  // NODROP guarantees no completion is lost on CQ overflow.
+  const unsigned kRequired = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+  if ((params.features & kRequired) != kRequired) {
+    LOG_WARN << "IoUringPoller - kernel lacks features " << kRequired
+             << ", falling back";
+    return false;
+  }
+
+  sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (singleMmap) {
+    sqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    cqRingSize_ = sqRingSize_;
+  }
+
+  sqRing_ = ::mmap(NULL, sqRingSize_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQ_RING);
+  if (sqRing_ == MAP_FAILED) {
+    LOG_SYSERR << "IoUringPoller - mmap sq ring";
+    return false;
+  }
+
+  if (singleMmap) {
+    cqRing_ = sqRing_;
+  } else {
+    cqRing_ = ::mmap(NULL, cqRingSize_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_CQ_RING);
+    if (cqRing_ == MAP_FAILED) {
+      LOG_SYSERR << "IoUringPoller - mmap cq ring";
+      return false;
+    }
+  }
+
+  sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = static_cast<io_uring_sqe*>(
+      ::mmap(NULL, sqesSize_, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQES));
+  if (sqes_ == MAP_FAILED) {
+    LOG_SYSERR << "IoUringPoller - mmap sqes";
+    return false;
+  }
+
+  char* sq = static_cast<char*>(sqRing_);
+  sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+  char* cq = static_cast<char*>(cqRing_);
+  cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  // FAST_POLL: a receive or send finding the socket not ready waits for
+  // it in the kernel, instead of blocking a kernel worker (5.7).
+  if (params.features & IORING_FEAT_FAST_POLL) {
+    completionIo_ = provideRecvBuffers();
+  } else {
+    LOG_WARN << "IoUringPoller - kernel lacks IORING_FEAT_FAST_POLL, "
+             << "polling only";
+  }
+
+  LOG_INFO << "IoUringPoller - ring fd " << ringfd_ << " with "
+           << params.sq_entries << " entries, completion I/O "
+           << (completionIo_ ? "on" : "off");
+  return true;
+}
+
+bool IoUringPoller::provideRecvBuffers() {
+  BOOST_STATIC_ASSERT(kRecvBuffers <= 65536);  // 16-bit buffer ids
+  recvBuffers_.resize(kRecvBuffers * kRecvBufferSize);
+  submitProvide(0, kRecvBuffers);
+
+  // Nothing else is in flight yet, wait for this one.
+  if (enter(unsubmitted(), 1, -1) < 0) {
+    LOG_SYSERR << "IoUringPoller - provide buffers, polling only";
+    return false;
+  }
+  unsigned head = *cqHead_;
+  assert(head != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE));
+  const int res = cqes_[head & cqMask_].res;
+  __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+  if (res < 0) {
+    errno = -res;
+    LOG_SYSERR << "IoUringPoller - provide buffers, polling only";
+    return false;
+  }
+  return true;
+}
+
+Timestamp IoUringPoller::poll(int timeoutMs, ChannelList* activeChannels) {
+  // The handlers of the last poll are done with these.
+  sentOwners_.clear();
+  recycleRecvBuffers();
+  armPending();
+
+  // Submits the queued changes and waits in the same syscall.
+  int ret = enter(unsubmitted(), timeoutMs == 0 ? 0 : 1, timeoutMs);
+  int savedErrno = errno;
+  Timestamp now(Timestamp::now());
+  // EBUSY: the completions overflowed, EAGAIN: out of memory for
+  // requests, both resolved by handling the completions we have.
+  if (ret < 0 && savedErrno != ETIME && savedErrno != EINTR &&
+      savedErrno != EBUSY && savedErrno != EAGAIN) {
+    errno = savedErrno;
+    LOG_SYSERR << "IoUringPoller::poll()";
+  }
+
+  size_t numEvents = activeChannels->size();
+  fillActiveChannels(activeChannels);
+  numEvents = activeChannels->size() - numEvents;
+  if (numEvents > 0) {
+    LOG_TRACE << numEvents << " events happended";
+  } else {
+    LOG_TRACE << " nothing happended";
+  }
+
+  return now;
+}
+
+void IoUringPoller::fillActiveChannels(ChannelList* activeChannels) {
+  for (std::vector<Completion>::const_iterator it = stashed_.begin();
+       it != stashed_.end(); ++it) {
+    handleCompletion(*it, activeChannels);
+  }
+  stashed_.clear();
+
+  unsigned head = *cqHead_;
+  const unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const io_uring_cqe& cqe = cqes_[head & cqMask_];
+    const Completion completion = { cqe.user_data, cqe.res, cqe.flags };
+    handleCompletion(completion, activeChannels);
+  }
+  __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+
+  for (std::vector<int>::const_iterator it = activeFds_.begin();
+       it != activeFds_.end(); ++it) {
+    Entry& entry = channels_[*it];
+    entry.active = false;
+    entry.revents = 0;
+  }
+  activeFds_.clear();
+}
+
+void IoUringPoller::handleCompletion(const Completion& cqe,
+                                     ChannelList* activeChannels) {
+  const uint32_t tag = static_cast<uint32_t>(cqe.userData);
+  const Op op = static_cast<Op>(tag & kOpMask);
+  if (op == kIgnore) {
+    return;
+  }
+
+  // What the request holds is released even if the channel is gone.
+  const char* data = NULL;
+  if (cqe.flags & IORING_CQE_F_BUFFER) {
+    const uint16_t buffer =
+        static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    data = &recvBuffers_[buffer * kRecvBufferSize];
+    usedRecvBuffers_.push_back(buffer);
+  }
+  if (op == kSend) {
+    SendMap::iterator it = sends_.find(cqe.userData);
+    assert(it != sends_.end());
+    sentOwners_.push_back(it->second.owner);
+    sends_.erase(it);
+  }
+  if (op != kPoll) {
+    --inflight_;
+  }
+
+  const int fd = static_cast<int>(cqe.userData >> 32);
+  ChannelMap::iterator it = channels_.find(fd);
+  if (it == channels_.end()) {
+    // Completion of a request we have removed since.
+    return;
+  }
+
+  Entry& entry = it->second;
+  switch (op) {
+    case kPoll:
+      if (entry.armed != tag) {
+        return;
+      }
+      entry.armed = 0;
+      entry.revents |= cqe.res < 0 ? POLLERR : cqe.res;
+      break;
+    case kRecv:
+      if (entry.receiving != tag) {
+        return;
+      }
+      entry.receiving = 0;
+      if (cqe.res == -ENOBUFS) {
+        // All taken, received again once given back.
+        scheduleArm(fd, &entry);
+        return;
+      }
+      entry.channel->set_recvDone(data, cqe.res);
+      break;
+    case kSend:
+      if (entry.sending != tag) {
+        return;
+      }
+      entry.sending = 0;
+      entry.channel->set_sendDone(cqe.res);
+      break;
+    default:
+      break;
+  }
+
+  // Events and completions of this poll, handled together.
+  entry.channel->set_revents(entry.revents);
+  if (!entry.active) {
+    entry.active = true;
+    activeChannels->push_back(entry.channel);
+    activeFds_.push_back(fd);
+  }
+  // One-shot, re-arm before the next wait if still interested.
+  scheduleArm(fd, &entry);
+}
+
+void IoUringPoller::UpdateChannel(Channel* channel) {
+  Poller::assertInLoopThread();
+  LOG_TRACE << "fd = " << channel->fd() << " events = " << channel->events();
+
+  const int fd = channel->fd();
+  if (channel->index() < 0) {
+    // A new one.
+    assert(channels_.find(fd) == channels_.end());
+    Entry entry = { channel, 0, 0, 0, 0, false, false, 0 };
+    channels_[fd] = entry;
+    channel->set_index(1);
+  }
+
+  ChannelMap::iterator it = channels_.find(fd);
+  assert(it != channels_.end());
+  assert(it->second.channel == channel);
+  Entry& entry = it->second;
+  if (entry.armed != 0 && entry.events != pollEvents(*channel)) {
+    submitPollRemove(fd, entry);
+    entry.armed = 0;
+  }
+
+  // A receive is left submitted when reading is disabled, it may still
+  // complete then, @see Channel::SetRecvDoneCb.
+  scheduleArm(fd, &entry);
+}
+
+void IoUringPoller::removeChannel(Channel* channel) {
+  Poller::assertInLoopThread();
+  const int fd = channel->fd();
+  LOG_TRACE << "fd = " << fd;
+  ChannelMap::iterator it = channels_.find(fd);
+  assert(it != channels_.end());
+  assert(it->second.channel == channel);
+  assert(channel->isNoneEvent());
+  const Entry& entry = it->second;
+  if (entry.armed != 0) {
+    submitPollRemove(fd, entry);
+  }
+  // Their completions still come, for what they hold.
+  if (entry.receiving != 0) {
+    submitCancel(makeUserData(fd, entry.receiving));
+  }
+  if (entry.sending != 0) {
+    submitCancel(makeUserData(fd, entry.sending));
+  }
+  channels_.erase(it);
+  channel->set_index(-1);
+}
+
+void IoUringPoller::scheduleArm(int fd, Entry* entry) {
+  if (!entry->pending) {
+    entry->pending = true;
+    pendingArms_.push_back(fd);
+  }
+}
+
+void IoUringPoller::armPending() {
+  for (std::vector<int>::const_iterator it = pendingArms_.begin();
+       it != pendingArms_.end(); ++it) {
+    ChannelMap::iterator ch = channels_.find(*it);
+    if (ch == channels_.end()) {
+      continue;
+    }
+    Entry& entry = ch->second;
+    entry.pending = false;
+    if (entry.armed == 0 && pollEvents(*entry.channel) != 0) {
+      submitPollAdd(*it, &entry);
+    }
+    if (completionIo_ && entry.receiving == 0
+        && entry.channel->completionReads() && entry.channel->isReading()) {
+      submitRecv(*it, &entry);
+    }
+  }
+  pendingArms_.clear();
+}
+
+uint32_t IoUringPoller::nextTag(Op op) {
+  ++nextGeneration_;
+  return (nextGeneration_ << 2) | op;
+}
+
+int IoUringPoller::pollEvents(const Channel& channel) {
+  if (channel.completionReads()) {
+    return channel.events() & ~(POLLIN | POLLPRI);
+  }
+  return channel.events();
+}
+
+void IoUringPoller::submitPollAdd(int fd, Entry* entry) {
+  const uint32_t tag = nextTag(kPoll);
+  const int events = pollEvents(*entry->channel);
+
+  io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  uint32_t mask = static_cast<uint32_t>(events);
+#if __BYTE_ORDER == __BIG_ENDIAN
+  // poll32_events is read as two swapped 16-bit halves on big endian.
+  mask = (mask << 16) | (mask >> 16);
+#endif
+  sqe->poll32_events = mask;
+  sqe->user_data = makeUserData(fd, tag);
+
+  entry->armed = tag;
+  entry->events = events;
+}
+
+void IoUringPoller::submitPollRemove(int fd, const Entry& entry) {
+  io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = makeUserData(fd, entry.armed);
+  sqe->user_data = kIgnoreUserData;
+}
+
+void IoUringPoller::submitRecv(int fd, Entry* entry) {
+  const uint32_t tag = nextTag(kRecv);
+
+  io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  // The kernel picks a buffer of the group once data is there.
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kRecvBufferGroup;
+  sqe->len = static_cast<uint32_t>(kRecvBufferSize);
+  sqe->user_data = makeUserData(fd, tag);
+
+  entry->receiving = tag;
+  ++inflight_;
+}
+
+void IoUringPoller::submitSend(Channel* channel,
+                               const struct iovec* iov,
+                               int iovcnt,
+                               const boost::shared_ptr<void>& owner) {
+  Poller::assertInLoopThread();
+  assert(completionIo_);
+  const int fd = channel->fd();
+  ChannelMap::iterator it = channels_.find(fd);
+  assert(it != channels_.end());
+  assert(it->second.channel == channel);
+  Entry& entry = it->second;
+  assert(entry.sending == 0);
+
+  const uint32_t tag = nextTag(kSend);
+  const uint64_t userData = makeUserData(fd, tag);
+  // The kernel may read the msghdr and iovecs after the submission.
+  Send& send = sends_[userData];
+  iovcnt = std::min(iovcnt, kMaxSendIovecs);
+  std::copy(iov, iov + iovcnt, send.iov);
+  bzero(&send.msg, sizeof send.msg);
+  send.msg.msg_iov = send.iov;
+  send.msg.msg_iovlen = iovcnt;
+  send.owner = owner;
+
+  io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(&send.msg);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = userData;
+
+  entry.sending = tag;
+  ++inflight_;
+}
+
+void IoUringPoller::submitProvide(unsigned firstBuffer, unsigned count) {
+  io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = static_cast<int>(count);
+  sqe->addr = reinterpret_cast<uint64_t>(
+      &recvBuffers_[firstBuffer * kRecvBufferSize]);
+  sqe->len = static_cast<uint32_t>(kRecvBufferSize);
+  sqe->off = firstBuffer;
+  sqe->buf_group = kRecvBufferGroup;
+  sqe->user_data = kIgnoreUserData;
+}
+
+void IoUringPoller::submitCancel(uint64_t userData) {
+  io_uring_sqe* sqe = getSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = userData;
+  sqe->user_data = kIgnoreUserData;
+}
+
+void IoUringPoller::recycleRecvBuffers() {
+  // Submitted before the receives that may need them.
+  for (std::vector<uint16_t>::const_iterator it = usedRecvBuffers_.begin();
+       it != usedRecvBuffers_.end(); ++it) {
+    submitProvide(*it, 1);
+  }
+  usedRecvBuffers_.clear();
+}
+
+io_uring_sqe* IoUringPoller::getSqe() {
+  unsigned tail = *sqTail_;
+  unsigned backoffUs = kMinBackoffUs;
+  while (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) > sqMask_) {
+    // The submission queue is full, hand it to the kernel now.
+    if (enter(unsubmitted(), 0, 0) >= 0 || errno == EINTR) {
+      continue;
+    }
+    if (errno == EBUSY) {
+      // The completions overflowed, which holds back submissions too.
+      // Make room, they are handled by the next poll.
+      stashCompletions();
+    } else if (errno != EAGAIN && errno != ETIME) {
+      LOG_SYSFATAL << "IoUringPoller - io_uring_enter";
+    }
+    // The kernel is short of memory for requests or still posting the
+    // completions, give it some time.
+    ::usleep(backoffUs);
+    backoffUs = std::min(backoffUs * 2, kMaxBackoffUs);
+  }
+
+  unsigned index = tail & sqMask_;
+  io_uring_sqe* sqe = &sqes_[index];
+  bzero(sqe, sizeof *sqe);
+  sqArray_[index] = index;
+  // Only consumed by the kernel in io_uring_enter, on this thread.
+  __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+  return sqe;
+}
+
+void IoUringPoller::stashCompletions() {
+  unsigned head = *cqHead_;
+  const unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const io_uring_cqe& cqe = cqes_[head & cqMask_];
+    const Completion completion = { cqe.user_data, cqe.res, cqe.flags };
+    stashed_.push_back(completion);
+  }
+  __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+}
+
+void IoUringPoller::drainOnExit() {
+  for (ChannelMap::const_iterator it = channels_.begin();
+       it != channels_.end(); ++it) {
+    if (it->second.receiving != 0) {
+      submitCancel(makeUserData(it->first, it->second.receiving));
+    }
+  }
+  for (SendMap::const_iterator it = sends_.begin(); it != sends_.end(); ++it) {
+    submitCancel(it->first);
+  }
+
+  for (int i = 0; i < kExitWaits && inflight_ > 0; ++i) {
+    enter(unsubmitted(), 1, kExitWaitMs);
+    stashCompletions();
+    for (std::vector<Completion>::const_iterator it = stashed_.begin();
+         it != stashed_.end(); ++it) {
+      const Op op = static_cast<Op>(it->userData & kOpMask);
+      if (op == kRecv || op == kSend) {
+        --inflight_;
+        sends_.erase(it->userData);
+      }
+    }
+    stashed_.clear();
+  }
+  if (inflight_ > 0) {
+    LOG_ERROR << "IoUringPoller - " << inflight_
+              << " requests still in flight on exit";
+  }
+}
+
+unsigned IoUringPoller::unsubmitted() const {
+  return *sqTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+}
+
+int IoUringPoller::enter(unsigned toSubmit, unsigned minComplete,
+                         int timeoutMs) {
+  __kernel_timespec ts;
+  io_uring_getevents_arg arg;
+  bzero(&arg, sizeof arg);
+  if (timeoutMs >= 0) {
+    ts.tv_sec = timeoutMs / 1000;
+    ts.tv_nsec = (timeoutMs % 1000) * 1000 * 1000;
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+  }
+
+  return ioUringEnter(ringfd_, toSubmit, minComplete,
+                      IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                      &arg, sizeof arg);
+}
@@ -0,0 +1,174 @@
+#ifndef COBRA_POLLER_IO_URING_POLLER_H_
+#define COBRA_POLLER_IO_URING_POLLER_H_
+
+#include "cobra/poller.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <map>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace cobra {
+
+//
+// IO Multiplexing with io_uring(7).
+//
+// Interest changes are queued as submission entries and handed to the
+// kernel by the same io_uring_enter(2) that waits for completions, so a
+// loop iteration costs one syscall no matter how many channels changed.
+//
+// Poll requests are one-shot and re-armed lazily on the next poll(),
+// which keeps the level-triggered semantics the handlers rely on.
+//
+// Channels with a recv done callback aren't polled for reading, a
+// receive is kept submitted instead, into buffers of ours the kernel
+// picks from when data comes in (so idle channels hold none). Sends are
+// submitted by the owner of the channel, @see Poller::submitSend. An
+// iteration then costs one io_uring_enter instead of a wait plus a read
+// and a write per active channel. This needs IORING_FEAT_FAST_POLL
+// (5.7), without it every channel is polled.
+//
+class IoUringPoller : public Poller {
+ public:
+  // Returns NULL if the running kernel doesn't support what we need,
+  // the caller should fall back to another poller then.
+  static IoUringPoller* create(Worker* loop);
+
+  virtual ~IoUringPoller();
+
+  virtual Timestamp poll(int timeoutMs, ChannelList* activeChannels);
+  virtual void UpdateChannel(Channel* channel);
+  virtual void removeChannel(Channel* channel);
+
+  virtual bool completionIo() const { return completionIo_; }
+  virtual void submitSend(Channel* channel,
+                          const struct iovec* iov,
+                          int iovcnt,
+                          const boost::shared_ptr<void>& owner);
+
+ private:
+  static const unsigned kEntries = 1024;
+  // The buffers receives complete into, 2M per loop.
+  static const unsigned kRecvBuffers = 128;
+  static const size_t kRecvBufferSize = 16 * 1024;
+  // The most iovecs of one send, the rest waits for the next one.
+  static const int kMaxSendIovecs = 64;
+  // Backing off while the kernel can't take more submissions.
+  static const unsigned kMinBackoffUs = 50;
+  static const unsigned kMaxBackoffUs = 10 * 1000;
+
+  // The request a completion is for, in the low bits of its user_data.
+  enum Op {
+    kIgnore = 0,
+    kPoll = 1,
+    kRecv = 2,
+    kSend = 3
+  };
+
+  struct Entry {
+    Channel* channel;
+    // The tag of the armed poll request, 0 if not armed.
+    uint32_t armed;
+    // The events the armed request waits for.
+    int events;
+    // The tags of the submitted receive and send, 0 if none.
+    uint32_t receiving;
+    uint32_t sending;
+    // Waiting in 'pendingArms_'.
+    bool pending;
+    // In the active channels of the current poll(), with these events.
+    bool active;
+    int revents;
+  };
+
+  // A submitted send, its memory is read by the kernel until completed.
+  struct Send {
+    msghdr msg;
+    iovec iov[kMaxSendIovecs];
+    boost::shared_ptr<void> owner;
+  };
+
+  // What we need of an io_uring_cqe, to keep it past the ring.
+  struct Completion {
+    uint64_t userData;
+    int32_t res;
+    uint32_t flags;
+  };
+
+  explicit IoUringPoller(Worker* loop);
+
+  bool setup();
+  bool provideRecvBuffers();
+  io_uring_sqe* getSqe();
+  unsigned unsubmitted() const;
+  int enter(unsigned toSubmit, unsigned minComplete, int timeoutMs);
+  uint32_t nextTag(Op op);
+  // The events to poll for, the receive stands for reading.
+  static int pollEvents(const Channel& channel);
+  void submitPollAdd(int fd, Entry* entry);
+  void submitPollRemove(int fd, const Entry& entry);
+  void submitRecv(int fd, Entry* entry);
+  void submitProvide(unsigned firstBuffer, unsigned count);
+  void submitCancel(uint64_t userData);
+  void recycleRecvBuffers();
+  void armPending();
+  void scheduleArm(int fd, Entry* entry);
+  // Moves the completions off the ring into 'stashed_'.
+  void stashCompletions();
+  void fillActiveChannels(ChannelList* activeChannels);
+  void handleCompletion(const Completion& cqe, ChannelList* activeChannels);
+  // Cancels the receives and sends and waits for them, before their
+  // memory goes away.
+  void drainOnExit();
+
+  typedef std::map<int, Entry> ChannelMap;
+  typedef std::map<uint64_t, Send> SendMap;
+
+  int ringfd_;
+
+  // The mmap'ed rings.
+  void* sqRing_;
+  size_t sqRingSize_;
+  void* cqRing_;
+  size_t cqRingSize_;
+  io_uring_sqe* sqes_;
+  size_t sqesSize_;
+
+  // Pointers into the rings.
+  unsigned* sqHead_;
+  unsigned* sqTail_;
+  unsigned sqMask_;
+  unsigned* sqArray_;
+  unsigned* cqHead_;
+  unsigned* cqTail_;
+  unsigned cqMask_;
+  io_uring_cqe* cqes_;
+
+  uint32_t nextGeneration_;
+  bool completionIo_;
+
+  ChannelMap channels_;
+  std::vector<int> pendingArms_;
+  // The fds of the active channels of the current poll().
+  std::vector<int> activeFds_;
+  // Taken off the ring while submitting, handled by the next poll().
+  std::vector<Completion> stashed_;
+
+  // kRecvBuffers of kRecvBufferSize.
+  std::vector<char> recvBuffers_;
+  // Handed to the channels, given back to the kernel on the next poll().
+  std::vector<uint16_t> usedRecvBuffers_;
+  SendMap sends_;
+  // Owners of the completed sends, released on the next poll().
+  std::vector<boost::shared_ptr<void> > sentOwners_;
+  // Receives and sends submitted and not completed yet.
+  unsigned inflight_;
+};
+
+}  // namespace cobra
+
+#endif  // COBRA_POLLER_IO_URING_POLLER_H_
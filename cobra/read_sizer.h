@@ -0,0 +1,67 @@
+// Author: Jianbo Zhu
+//
+// Adaptive size of the reads of a connection.
+
+#ifndef COBRA_READ_SIZER_H_
+#define COBRA_READ_SIZER_H_
+
+#include <stddef.h>
+
+#include "base/macros.h"
+
+namespace cobra {
+
+// Guesses how much the next read(2) of a socket brings, from the last
+// ones, like Netty's AdaptiveRecvByteBufAllocator. It doubles as soon
+// as a read fills the guess, and halves after two reads in a row which
+// didn't fill half of it, so a bulk transfer quickly gets large reads
+// while a chatty connection keeps a small buffer.
+//
+// Not thread safe.
+class ReadSizer {
+ public:
+  static const size_t kMinSize = 512;
+  static const size_t kInitialSize = 2048;
+  static const size_t kMaxSize = 256 * 1024;
+
+  ReadSizer()
+    : size_(kInitialSize),
+      shrinkPending_(false) {
+  }
+
+  // The bytes to make room for before the next read.
+  size_t next() const { return size_; }
+
+  // Back to the initial guess, eg. once the connection went quiet.
+  void reset() {
+    size_ = kInitialSize;
+    shrinkPending_ = false;
+  }
+
+  // Records a read of 'n' bytes.
+  void record(size_t n) {
+    if (n >= size_) {
+      size_ = size_ * 2 < kMaxSize ? size_ * 2 : kMaxSize;
+      shrinkPending_ = false;
+    } else if (n < size_ / 2) {
+      if (shrinkPending_) {
+        size_ = size_ / 2 > kMinSize ? size_ / 2 : kMinSize;
+        shrinkPending_ = false;
+      } else {
+        shrinkPending_ = true;
+      }
+    } else {
+      shrinkPending_ = false;
+    }
+  }
+
+ private:
+  size_t size_;
+  bool shrinkPending_;
+
+  DISABLE_COPY_AND_ASSIGN(ReadSizer);
+};
+
+}  // namespace cobra
+
+#endif  // COBRA_READ_SIZER_H_
@@ -1,45 +1,74 @@
 #include "cobra/server.h"
 
-#include <cstdio>
+#include <algorithm>
 
 #include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
 
+#include "base/CountDownLatch.h"
 #include "base/Logging.h"
 #include "cobra/acceptor.h"
+#include "cobra/connection_pool.h"
 #include "cobra/worker.h"
 #include "cobra/worker_thread_pool.h"
 #include "cobra/socket_wrapper.h"
 
 namespace cobra {
 
+namespace {
+
+void destroyAcceptor(Acceptor* acceptor, CountDownLatch* latch) {
+  delete acceptor;
+  latch->countDown();
+}
+
+}  // Anonymous namespace
+
+const double Server::kInputSweepSeconds = 10.0;
+
 Server::Server(Worker* loop,
                const Endpoint& listenAddr,
-               const string& server_name)
+               const string& server_name,
+               Option option)
   : started_(false),
+    reusePort_(option == kReusePort),
+    edgeTriggered_(false),
+    autoCork_(false),
+    zeroCopyThreshold_(0),
+    idleTimeout_(0.0),
     loop_(CHECK_NOTNULL(loop)),
+    listenAddr_(listenAddr),
     hostport_(listenAddr.toIpPort()),
     name_(server_name),
-    acceptor_(new Acceptor(loop, listenAddr)),
+    connNamePrefix_(new string(server_name + ":" + hostport_ + "#")),
+    loopsAccept_(false),
     thread_pool_(new WorkerThreadPool(loop)),
     connectionCb_(defaultConnectionCb),
     messageCb_(defaultMessageCb) {
-  // Called when an connection is accpeted, @see Acceptor::HandleRead which is
-  // called when a connection request is listened on 'listen fd'.
-  acceptor_->SetNewConnectionCb(
-      boost::bind(&Server::EstablishConnection, this, _1, _2));
 }
 
 Server::~Server() {
   loop_->assertInLoopThread();
   LOG_TRACE << "Server::~Server [" << name_ << "] dying";
 
-  for (ConnectionMap::iterator iter = connections_.begin();
-      iter != connections_.end(); ++iter) {
-    TcpConnectionPtr conn = iter->second;
-    iter->second.reset();
-    conn->getLoop()->runInLoop(
-      boost::bind(&TcpConnection::ConnectionDestroyed, conn));
-    conn.reset();
+  // The loop acceptors must be gone before we are, and they must go
+  // in their own loop.
+  for (size_t i = 0; i < loopAcceptors_.size(); ++i) {
+    CountDownLatch latch(1);
+    Acceptor* acceptor = loopAcceptors_[i];
+    acceptor->GetWorker()->runInLoop(
+        boost::bind(destroyAcceptor, acceptor, &latch));
+    latch.wait();
+  }
+  loopAcceptors_.clear();
+
+  // The registries go with us, empty them in their loop. Connections
+  // handed over before are queued ahead, so none is left behind.
+  for (size_t i = 0; i < registries_.size(); ++i) {
+    CountDownLatch latch(1);
+    registries_[i].loop->runInLoop(
+        boost::bind(&Server::DestroyConnections, &registries_[i], &latch));
+    latch.wait();
   }
 }
 
@@ -48,6 +77,14 @@ void Server::SetThreadNum(uint32 threads) {
   thread_pool_->setThreadNum(threads);
 }
 
+void Server::SetTimerType(Worker::TimerType type) {
+  thread_pool_->setTimerType(type);
+}
+
+void Server::SetDispatchPolicy(WorkerThreadPool::DispatchPolicy policy) {
+  thread_pool_->setDispatchPolicy(policy);
+}
+
 // FIXME(zhujianbo): make it thread safe
 void Server::start() {
   if (started_) {
@@ -56,67 +93,220 @@ void Server::start() {
 
   thread_pool_->start(threadInitCb_);
 
-  assert(!acceptor_->Listenning());
+  std::vector<Worker*> loops = thread_pool_->getAllLoops();
+  for (size_t i = 0; i < loops.size(); ++i) {
+    Registry* registry = new Registry;
+    registry->loop = loops[i];
+    if (idleTimeout_ > 0.0) {
+      registry->idleRing.reset(
+          new IdleRing(loops[i], idleTimeout_,
+                       boost::bind(&Server::ExpireConnection, this, _1)));
+    }
+    registry->inputSweepTimer = loops[i]->runEvery(
+        kInputSweepSeconds, boost::bind(&Server::SweepInput, registry));
+    registries_.push_back(registry);
+  }
 
-  // Start listening and then accepting connections right now.
-  loop_->runInLoop(
-      boost::bind(&Acceptor::Listen, get_pointer(acceptor_)));
+  // Without I/O threads, kReusePort accepts in loop's thread as usual.
+  // Set before any acceptor listens, EstablishConnections reads it.
+  loopsAccept_ = reusePort_ && !(loops.size() == 1 && loops[0] == loop_);
+  if (loopsAccept_) {
+    StartLoopAcceptors();
+  } else {
+    acceptor_.reset(new Acceptor(loop_, listenAddr_, reusePort_));
+    // Called when an connection is accpeted, @see Acceptor::HandleRead
+    // which is called when a connection request is listened on
+    // 'listen fd'.
+    acceptor_->SetNewConnectionsCb(
+        boost::bind(&Server::EstablishConnections, this, _1));
+    // Start listening and then accepting connections right now.
+    loop_->runInLoop(
+        boost::bind(&Acceptor::Listen, get_pointer(acceptor_)));
+  }
 
   started_ = true;
 }
 
-void Server::EstablishConnection(int32 conn_fd, const Endpoint& peer_address) {
-  loop_->assertInLoopThread();
+void Server::StartLoopAcceptors() {
+  std::vector<Worker*> loops = thread_pool_->getAllLoops();
+  // All bound before any listens, so the list doesn't change under the
+  // loops accepting already.
+  for (size_t i = 0; i < loops.size(); ++i) {
+    Acceptor* acceptor = new Acceptor(loops[i], listenAddr_, true);
+    acceptor->SetNewConnectionsCb(
+        boost::bind(&Server::EstablishConnections, this, _1));
+    loopAcceptors_.push_back(acceptor);
+  }
+  for (size_t i = 0; i < loops.size(); ++i) {
+    loops[i]->runInLoop(boost::bind(&Acceptor::Listen, loopAcceptors_[i]));
+  }
+}
+
+void Server::EstablishConnections(const Acceptor::AcceptedList& accepted) {
+  // A handful of loops at most, a linear search does.
+  std::vector<Handoff> handoffs;
+  for (size_t i = 0; i < accepted.size(); ++i) {
+    Worker* ioLoop = NULL;
+    if (!loopsAccept_) {
+      loop_->assertInLoopThread();
+      // This new connection is assign to a event_loop thread according
+      // to the dispatch policy.
+      ioLoop = thread_pool_->getNextLoop();
+    } else {
+      // Accepted by the I/O loop itself, which serves it.
+      ioLoop = Worker::getWorkerOfCurrentThread();
+    }
 
-  // This new connection is assign to a event_loop thread in a round-robin way.
-  Worker* ioLoop = thread_pool_->getNextLoop();
-  static uint32 next_conn_id = 0;
-  char buf[32];
-  snprintf(buf, sizeof buf, ":%s#%d", hostport_.c_str(), next_conn_id);
-  ++next_conn_id;
-  string connName = name_ + buf;
+    size_t j = 0;
+    while (j < handoffs.size() && handoffs[j].registry->loop != ioLoop) {
+      ++j;
+    }
+    if (j == handoffs.size()) {
+      handoffs.push_back(Handoff());
+      handoffs.back().registry = RegistryOf(ioLoop);
+      handoffs.back().conns.reserve(accepted.size());
+    }
+    handoffs[j].conns.push_back(NewConnection(handoffs[j].registry,
+                                              accepted[i].first,
+                                              accepted[i].second));
+  }
+
+  // Run TcpConnection::connectEstablished immediately, one wakeup per
+  // loop for the whole batch.
+  for (size_t j = 0; j < handoffs.size(); ++j) {
+    handoffs[j].registry->loop->runInLoop(
+        boost::bind(&Server::EstablishInLoop, this,
+                    handoffs[j].registry, handoffs[j].conns));
+  }
+}
+
+TcpConnectionPtr Server::NewConnection(Registry* registry,
+                                       int32 conn_fd,
+                                       const Endpoint& peer_address) {
+  // Starts at 1, 0 is no id.
+  const uint64 connId = nextConnId_.incrementAndGet();
 
-  LOG_INFO << "Server::EstablishConnection [" << name_
-           << "] - new connection [" << connName
+  LOG_INFO << "Server::NewConnection [" << name_
+           << "] - new connection [" << *connNamePrefix_ << connId
            << "] from " << peer_address.toIpPort();
   Endpoint local_address(getLocalAddr(conn_fd));
   // FIXME poll with zero timeout to double confirm the new connection
-  // FIXME use make_shared if necessary
-  TcpConnectionPtr conn(new TcpConnection(ioLoop,
-                                          connName,
-                                          conn_fd,
-                                          local_address,
-                                          peer_address));
-
-  // Records the new connection.
-  connections_[connName] = conn;
+  // One allocation for the connection and its control block, recycled
+  // by the loop.
+  TcpConnectionPtr conn = boost::allocate_shared<TcpConnection>(
+      ConnectionPoolAllocator<TcpConnection>(
+          registry->loop->connectionPool()),
+      registry->loop,
+      connId,
+      connNamePrefix_,
+      conn_fd,
+      local_address,
+      peer_address);
 
   // Set callbacks for this connection.
   conn->SetConnectionCb(connectionCb_);
   conn->SetMessageCb(messageCb_);
   conn->SetWriteCompleteCb(writeCompleteCb_);
   conn->SetCloseCb(
-      boost::bind(&Server::RemoveConnection, this, _1)); // FIXME: unsafe
+      boost::bind(&Server::RemoveConnection, this, registry, _1));
+  conn->setEdgeTriggered(edgeTriggered_);
+  conn->setAutoCork(autoCork_);
+  if (zeroCopyThreshold_ > 0) {
+    conn->setZeroCopyThreshold(zeroCopyThreshold_);
+  }
+  return conn;
+}
 
-  // Run TcpConnection::connectEstablished immediately.
-  ioLoop->runInLoop(boost::bind(&TcpConnection::ConnectionEstablished, conn));
+void Server::EstablishInLoop(Registry* registry,
+                             const std::vector<TcpConnectionPtr>& conns) {
+  registry->loop->assertInLoopThread();
+  for (size_t i = 0; i < conns.size(); ++i) {
+    // Records the new connection.
+    registry->connections.insert(conns[i]->id(), conns[i]);
+    conns[i]->setIdleRing(get_pointer(registry->idleRing));
+    conns[i]->ConnectionEstablished();
+  }
+  registry->count.add(static_cast<int32>(conns.size()));
 }
 
-void Server::RemoveConnection(const TcpConnectionPtr& conn) {
-  // FIXME: unsafe
-  loop_->runInLoop(boost::bind(&Server::RemoveConnectionInLoop, this, conn));
+Server::Registry* Server::RegistryOf(Worker* loop) {
+  for (size_t i = 0; i < registries_.size(); ++i) {
+    if (registries_[i].loop == loop) {
+      return &registries_[i];
+    }
+  }
+  return NULL;
 }
 
-void Server::RemoveConnectionInLoop(const TcpConnectionPtr& conn) {
-  loop_->assertInLoopThread();
-  LOG_INFO << "Server::RemoveConnectionInLoop [" << name_
+int64 Server::AcceptWakeups() {
+  int64 n = acceptor_ ? acceptor_->AcceptWakeups() : 0;
+  for (size_t i = 0; i < loopAcceptors_.size(); ++i) {
+    n += loopAcceptors_[i]->AcceptWakeups();
+  }
+  return n;
+}
+
+int64 Server::AcceptedConnections() {
+  int64 n = acceptor_ ? acceptor_->AcceptedConnections() : 0;
+  for (size_t i = 0; i < loopAcceptors_.size(); ++i) {
+    n += loopAcceptors_[i]->AcceptedConnections();
+  }
+  return n;
+}
+
+int32 Server::MaxAcceptedPerWakeup() {
+  int32 n = acceptor_ ? acceptor_->MaxAcceptedPerWakeup() : 0;
+  for (size_t i = 0; i < loopAcceptors_.size(); ++i) {
+    n = std::max(n, loopAcceptors_[i]->MaxAcceptedPerWakeup());
+  }
+  return n;
+}
+
+int32 Server::ConnectionCount() {
+  int32 n = 0;
+  for (size_t i = 0; i < registries_.size(); ++i) {
+    n += registries_[i].count.get();
+  }
+  return n;
+}
+
+void Server::RemoveConnection(Registry* registry,
+                              const TcpConnectionPtr& conn) {
+  registry->loop->assertInLoopThread();
+  LOG_INFO << "Server::RemoveConnection [" << name_
            << "] - connection " << conn->name();
-  size_t n = connections_.erase(conn->name());
-  (void)n;
-  assert(n == 1);
-  Worker* ioLoop = conn->getLoop();
-  ioLoop->queueInLoop(
+  bool erased = registry->connections.erase(conn->id());
+  (void)erased;
+  assert(erased);
+  registry->count.decrement();
+  // Not right away, we are called by the channel of the connection.
+  registry->loop->queueInLoop(
       boost::bind(&TcpConnection::ConnectionDestroyed, conn));
 }
 
+void Server::ExpireConnection(TcpConnection* conn) {
+  LOG_INFO << "Server::ExpireConnection [" << name_
+           << "] - connection " << conn->name() << " idle for "
+           << idleTimeout_ << "s";
+  conn->forceClose();
+}
+
+void Server::SweepInput(Registry* registry) {
+  registry->connections.forEach(
+      boost::bind(&TcpConnection::shrinkInputIfIdle, _1));
+}
+
+void Server::DestroyConnections(Registry* registry, CountDownLatch* latch) {
+  registry->loop->cancel(registry->inputSweepTimer);
+  std::vector<TcpConnectionPtr> conns;
+  registry->connections.takeAll(&conns);
+  registry->count.getAndSet(0);
+  for (size_t i = 0; i < conns.size(); ++i) {
+    conns[i]->ConnectionDestroyed();
+  }
+  // Its timer must be canceled in the loop.
+  registry->idleRing.reset();
+  latch->countDown();
+}
+
 }  // namespace cobra
@@ -5,29 +5,43 @@
 #ifndef COBRA_SERVER_H_
 #define COBRA_SERVER_H_
 
-#include <map>
+#include <vector>
 
 #include <boost/function.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include "base/basic_types.h"
 #include "base/macros.h"
 #include "base/Atomic.h"
+#include "cobra/acceptor.h"
+#include "cobra/connection_table.h"
+#include "cobra/idle_ring.h"
 #include "cobra/tcp_connection.h"
+#include "cobra/worker.h"
+#include "cobra/worker_thread_pool.h"
 
 namespace cobra {
 
-class Acceptor;
-class Worker;
-class WorkerThreadPool;
-
+class CountDownLatch;
 class Server {
  public:
   typedef boost::function<void(Worker*)> ThreadInitCb;
 
+  enum Option {
+    // One acceptor in loop's thread, handing connections over to
+    // the I/O threads.
+    kNoReusePort,
+    // Each I/O thread listens with its own SO_REUSEPORT socket and
+    // serves what it accepts, the kernel spreads the connections.
+    kReusePort
+  };
+
   Server(Worker* loop,
          const Endpoint& listen_address,
-         const string& server_name = "server");
+         const string& server_name = "server",
+         Option option = kNoReusePort);
   virtual ~Server();
 
   inline Worker* GetWorker() const {
@@ -36,19 +50,57 @@ class Server {
 
   // Set the number of threads for handling input.
   //
-  // Always accepts new connection in loop's thread.
+  // Accepts new connection in loop's thread, unless in kReusePort mode
+  // with I/O threads.
   // Must be called before @c start
   // @param numThreads
   // - 0 means all I/O in loop's thread, no thread will created.
   //   this is the default value.
   // - 1 means all I/O in another thread.
   // - N means a thread pool with N threads, new connections
-  //   are assigned on a round-robin basis.
+  //   are assigned on a round-robin basis, @see SetDispatchPolicy.
   void SetThreadNum(uint32 numThreads);
   inline void SetThreadInitCb(const ThreadInitCb& cb) {
     threadInitCb_ = cb;
   }
 
+  // Set the timer implementation of the I/O threads.
+  // Must be called before @c start
+  void SetTimerType(Worker::TimerType type);
+
+  // Set how new connections are spread over the I/O threads, round-robin
+  // by default. Not used in kReusePort mode, where the kernel does it.
+  // Must be called before @c start
+  void SetDispatchPolicy(WorkerThreadPool::DispatchPolicy policy);
+
+  // Serve connections in edge-triggered mode,
+  // @see TcpConnection::setEdgeTriggered.
+  // Must be called before @c start
+  inline void SetEdgeTriggered(bool on) {
+    edgeTriggered_ = on;
+  }
+
+  // Serve connections in auto-cork mode, @see TcpConnection::setAutoCork.
+  // Must be called before @c start
+  inline void SetAutoCork(bool on) {
+    autoCork_ = on;
+  }
+
+  // Force close connections idle (nothing read nor written) for
+  // 'seconds', 0 (the default) never does. A ring of buckets per I/O
+  // loop keeps track of them, @see IdleRing.
+  // Must be called before @c start
+  inline void SetIdleTimeout(double seconds) {
+    idleTimeout_ = seconds;
+  }
+
+  // Send large blocks with MSG_ZEROCOPY,
+  // @see TcpConnection::setZeroCopyThreshold.
+  // Must be called before @c start
+  inline void SetZeroCopyThreshold(size_t threshold) {
+    zeroCopyThreshold_ = threshold;
+  }
+
   // Starts the server if it's not listenning.
   //
   // It's harmless to call it multiple times.
@@ -79,26 +131,99 @@ class Server {
     writeCompleteCb_ = cb;
   }
 
+  ////////////////////// begin /////////////////////////////////
+  // accept statistics summed over the acceptors,
+  // @see Acceptor::AcceptWakeups.
+  // Thread safe once started.
+
+  int64 AcceptWakeups();
+  int64 AcceptedConnections();
+  int32 MaxAcceptedPerWakeup();
+  ///////////////////////// end ///////////////////////////////
+
+  // Number of established connections.
+  // Thread safe.
+  int32 ConnectionCount();
+
  private:
-  // Not thread safe, but in loop
+  // The connections served by one I/O loop, only touched in that loop,
+  // so establishing and closing them never leave it.
+  struct Registry {
+    Worker* loop;
+    ConnectionTable connections;
+    // connections.size(), for other threads.
+    AtomicInt32 count;
+    // If there's an idle timeout.
+    boost::scoped_ptr<IdleRing> idleRing;
+    // @see SweepInput.
+    TimerId inputSweepTimer;
+  };
+
+  // The connections of one accept batch handed over to the same loop.
+  struct Handoff {
+    Registry* registry;
+    std::vector<TcpConnectionPtr> conns;
+  };
+
+  // Not thread safe, but in the accepting loop
   //
-  // Establish a connection.
+  // Establishes the connections accepted by one wakeup of an acceptor,
+  // handing them over to each I/O loop at once.
   // It's used as a callback function.
-  void EstablishConnection(int32 sockfd, const Endpoint& peerAddr);
+  void EstablishConnections(const Acceptor::AcceptedList& accepted);
 
-  // Thread safe.
-  void RemoveConnection(const TcpConnectionPtr& conn);
+  // Creates the connection served by the loop of 'registry'.
+  TcpConnectionPtr NewConnection(Registry* registry,
+                                 int32 sockfd,
+                                 const Endpoint& peerAddr);
+
+  // In the loop of 'registry'.
+  void EstablishInLoop(Registry* registry,
+                       const std::vector<TcpConnectionPtr>& conns);
+
+  // The registry of 'loop', @c NULL if it's not one of ours.
+  Registry* RegistryOf(Worker* loop);
+
+  // Starts the acceptor of every I/O loop, in kReusePort mode.
+  void StartLoopAcceptors();
+
+  // In the loop of 'registry', @see TcpConnection::handleClose.
+  void RemoveConnection(Registry* registry, const TcpConnectionPtr& conn);
+
+  // In the loop of 'registry', every kInputSweepSeconds, shrinks the
+  // input buffers of the connections that read nothing since the last
+  // time, @see TcpConnection::shrinkInputIfIdle.
+  static void SweepInput(Registry* registry);
+
+  // In the loop of an IdleRing, closes an idle connection.
+  void ExpireConnection(TcpConnection* conn);
+
+  // In the loop of 'registry', on destruction.
+  static void DestroyConnections(Registry* registry, CountDownLatch* latch);
 
-  // Not thread safe, but in loop
-  void RemoveConnectionInLoop(const TcpConnectionPtr& conn);
+  static const double kInputSweepSeconds;
 
   bool started_;
+  const bool reusePort_;
+  bool edgeTriggered_;
+  bool autoCork_;
+  size_t zeroCopyThreshold_;
+  double idleTimeout_;
   Worker* loop_;  // the acceptor loop
+  const Endpoint listenAddr_;
   const string hostport_;
   const string name_;
+  // "name:host:port#", the connections append their id.
+  const boost::shared_ptr<const string> connNamePrefix_;
 
+  // The I/O loops accept, with loopAcceptors_, not loop's thread with
+  // acceptor_. Only one of them is created, by start().
+  bool loopsAccept_;
   boost::scoped_ptr<Acceptor> acceptor_;
   boost::scoped_ptr<WorkerThreadPool> thread_pool_;
+  // kReusePort mode, one per I/O loop, destroyed in their loop.
+  std::vector<Acceptor*> loopAcceptors_;
+  AtomicInt64 nextConnId_;
 
   // The callback functions
   ThreadInitCb threadInitCb_;
@@ -106,9 +231,8 @@ class Server {
   MessageCb messageCb_;
   WriteCompleteCb writeCompleteCb_;
 
-  // The established connections
-  typedef std::map<string, TcpConnectionPtr> ConnectionMap;
-  ConnectionMap connections_;
+  // One per I/O loop, set up by start().
+  boost::ptr_vector<Registry> registries_;
 
   DISABLE_COPY_AND_ASSIGN(Server);
 };
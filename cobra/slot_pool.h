@@ -0,0 +1,176 @@
+// Author: Jianbo Zhu
+//
+// A slab of fixed-size slots addressed by (index, generation).
+
+#ifndef COBRA_SLOT_POOL_H_
+#define COBRA_SLOT_POOL_H_
+
+#include <assert.h>
+
+#include <new>
+
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+#include "base/basic_types.h"
+#include "base/Logging.h"
+#include "base/macros.h"
+
+namespace cobra {
+
+// Storage for objects of type T, carved out of chunks which are never
+// given back until the pool dies, so a steady churn allocates nothing.
+//
+// Each slot carries a generation bumped on release. An (index, generation)
+// handle thus stays cheap to validate after the object is gone, which
+// makes it a safe opaque id to hand out, @see TimerId.
+//
+// acquire() is thread safe, everything else must be called by the owner
+// thread. The free list uses (tag, index) pairs packed into 64 bits to
+// avoid ABA problems, like MpscQueue does.
+template <typename T>
+class SlotPool {
+ public:
+  static const uint32 kInvalidIndex = 0xffffffff;
+
+  SlotPool()
+    : freeList_(kInvalidIndex),
+      numChunks_(0) {
+    for (uint32 i = 0; i < kMaxChunks; ++i) {
+      chunks_[i] = NULL;
+    }
+  }
+
+  // The owner must have released all the objects.
+  ~SlotPool() {
+    for (uint32 i = 0; i < kMaxChunks; ++i) {
+      delete[] chunks_[i];
+    }
+  }
+
+  // Reserves a slot, to be constructed with placement new on
+  // storage(). Returns its index and stores its generation.
+  // Thread safe.
+  uint32 acquire(uint32* generation) {
+    Slot* slot = popFree();
+    if (slot == NULL) {
+      slot = newChunk();
+    }
+    *generation = slot->generation;
+    return slot->index;
+  }
+
+  void* storage(uint32 index) {
+    return slotAt(index)->storage.address();
+  }
+
+  T* at(uint32 index) {
+    return static_cast<T*>(storage(index));
+  }
+
+  // The object if 'generation' is still current, NULL otherwise.
+  T* get(uint32 index, uint32 generation) {
+    if (index >= numSlots()) {
+      return NULL;
+    }
+    Slot* slot = slotAt(index);
+    return slot->generation == generation ? at(index) : NULL;
+  }
+
+  // Destroys the object and recycles the slot, invalidating its handles.
+  void release(uint32 index) {
+    Slot* slot = slotAt(index);
+    at(index)->~T();
+    ++slot->generation;
+    if (slot->generation == 0) {
+      // 0 is never valid, @see TimerId.
+      slot->generation = 1;
+    }
+    pushFree(slot, slot);
+  }
+
+ private:
+  // 1024 slots per chunk, up to 4M slots.
+  static const uint32 kChunkShift = 10;
+  static const uint32 kChunkSize = 1 << kChunkShift;
+  static const uint32 kMaxChunks = 4096;
+
+  struct Slot {
+    uint32 index;
+    uint32 generation;
+    // Next slot in the free list.
+    uint32 freeNext;
+    typename boost::aligned_storage<
+        sizeof(T), boost::alignment_of<T>::value>::type storage;
+  };
+
+  static uint64 pack(uint64 tag, uint32 index) {
+    return (tag << 32) | index;
+  }
+
+  uint32 numSlots() const {
+    uint32 chunks = __atomic_load_n(&numChunks_, __ATOMIC_ACQUIRE);
+    return (chunks < kMaxChunks ? chunks : kMaxChunks) << kChunkShift;
+  }
+
+  Slot* slotAt(uint32 index) const {
+    return &chunks_[index >> kChunkShift][index & (kChunkSize - 1)];
+  }
+
+  Slot* popFree() {
+    for (;;) {
+      uint64 old = __atomic_load_n(&freeList_, __ATOMIC_ACQUIRE);
+      uint32 index = static_cast<uint32>(old);
+      if (index == kInvalidIndex) {
+        return NULL;
+      }
+      Slot* slot = slotAt(index);
+      // Stale if someone popped it meanwhile, the tag fails the CAS then.
+      uint64 next = pack((old >> 32) + 1, slot->freeNext);
+      if (__sync_bool_compare_and_swap(&freeList_, old, next)) {
+        return slot;
+      }
+    }
+  }
+
+  // Allocates a new chunk, keeps its first slot and donates the rest
+  // to the free list.
+  Slot* newChunk() {
+    uint32 c = __sync_fetch_and_add(&numChunks_, 1);
+    if (c >= kMaxChunks) {
+      LOG_FATAL << "SlotPool - out of slots";
+    }
+
+    Slot* chunk = new Slot[kChunkSize];
+    for (uint32 i = 0; i < kChunkSize; ++i) {
+      chunk[i].index = (c << kChunkShift) | i;
+      chunk[i].generation = 1;
+      chunk[i].freeNext = chunk[i].index + 1;
+    }
+    __atomic_store_n(&chunks_[c], chunk, __ATOMIC_RELEASE);
+    pushFree(&chunk[1], &chunk[kChunkSize - 1]);
+    return &chunk[0];
+  }
+
+  // Pushes the chain [first, last], already linked through 'freeNext'.
+  void pushFree(Slot* first, Slot* last) {
+    for (;;) {
+      uint64 old = __atomic_load_n(&freeList_, __ATOMIC_ACQUIRE);
+      last->freeNext = static_cast<uint32>(old);
+      if (__sync_bool_compare_and_swap(&freeList_, old,
+                                       pack((old >> 32) + 1, first->index))) {
+        return;
+      }
+    }
+  }
+
+  uint64 freeList_;
+  uint32 numChunks_;
+  Slot* chunks_[kMaxChunks];
+
+  DISABLE_COPY_AND_ASSIGN(SlotPool);
+};
+
+}  // namespace cobra
+
+#endif  // COBRA_SLOT_POOL_H_
@@ -1,11 +1,13 @@
 #include "cobra/socket_wrapper.h"
 
 #include <errno.h>
+#include <linux/errqueue.h>
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <stdio.h>
 #include <strings.h>  // bzero
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -81,7 +83,10 @@ int32 Accept(int32 listen_fd, Endpoint* peer_addr) {
 #endif
   if (conn_fd < 0) {
     int savedErrno = errno;
-    LOG_SYSERR << "accept";
+    if (savedErrno != EAGAIN) {
+      // EAGAIN just ends the accept loop of the caller.
+      LOG_SYSERR << "accept";
+    }
     switch (savedErrno) {
       case EAGAIN:
       case ECONNABORTED:
@@ -130,6 +135,57 @@ void SetReuseAddr(int32 sock_fd, bool on) {
   // FIXME CHECK
 }
 
+bool SetZeroCopy(int32 sock_fd, bool on) {
+#ifdef SO_ZEROCOPY
+  int optval = on ? 1 : 0;
+  int ret = ::setsockopt(sock_fd, SOL_SOCKET, SO_ZEROCOPY,
+                         &optval, static_cast<socklen_t>(sizeof optval));
+  if (ret < 0) {
+    LOG_SYSERR << "SO_ZEROCOPY failed.";
+    return false;
+  }
+  return true;
+#else
+  if (on) {
+    LOG_ERROR << "SO_ZEROCOPY is not supported.";
+  }
+  return false;
+#endif
+}
+
+int RecvZeroCopyCompletion(int32 sock_fd,
+                           uint32* lo, uint32* hi, bool* copied) {
+  char control[128];
+  msghdr msg;
+  bzero(&msg, sizeof msg);
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof control;
+
+  for (;;) {
+    if (::recvmsg(sock_fd, &msg, MSG_ERRQUEUE) < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+
+    for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+        cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+            (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+        continue;
+      }
+      const sock_extended_err* err =
+          reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cm));
+      if (err->ee_errno == 0 && err->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+        *lo = err->ee_info;
+        *hi = err->ee_data;
+        *copied = (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+        return 1;
+      }
+    }
+    // Something else, skip it.
+    msg.msg_controllen = sizeof control;
+  }
+}
+
 void SetReusePort(int32 sock_fd, bool on) {
 #ifdef SO_REUSEPORT
   int optval = on ? 1 : 0;
@@ -191,6 +247,18 @@ ssize_t write(int sockfd, const void *buf, size_t count) {
   return ::write(sockfd, buf, count);
 }
 
+ssize_t writev(int sockfd, const iovec *iov, int iovcnt) {
+  return ::writev(sockfd, iov, iovcnt);
+}
+
+ssize_t sendfile(int sockfd, int in_fd, off_t *offset, size_t count) {
+  return ::sendfile(sockfd, in_fd, offset, count);
+}
+
+ssize_t sendmsg(int sockfd, const msghdr *msg, int flags) {
+  return ::sendmsg(sockfd, msg, flags);
+}
+
 void close(int sockfd) {
   if (::close(sockfd) < 0) {
     LOG_SYSERR << "close";
@@ -6,6 +6,7 @@
 #define COBRA_SOCKET_WRAPPER_H_
 
 #include <arpa/inet.h>
+#include <sys/uio.h>
 
 #include "base/basic_types.h"
 #include "base/macros.h"
@@ -33,6 +34,11 @@ namespace cobra {
   ssize_t read(int sockfd, void *buf, size_t count);
   ssize_t readv(int sockfd, const iovec *iov, int iovcnt);
   ssize_t write(int sockfd, const void *buf, size_t count);
+  ssize_t writev(int sockfd, const iovec *iov, int iovcnt);
+  // Copies 'count' bytes of 'in_fd' from '*offset' in the kernel,
+  // @see sendfile(2).
+  ssize_t sendfile(int sockfd, int in_fd, off_t *offset, size_t count);
+  ssize_t sendmsg(int sockfd, const msghdr *msg, int flags);
   void close(int sockfd);
 
   int getSocketError(int sockfd);
@@ -55,6 +61,16 @@ namespace cobra {
   // Enable/disable SO_KEEPALIVE
   void SetKeepAlive(int32 sock_fd, bool on);
 
+  // Enable/disable SO_ZEROCOPY, @return false if not supported.
+  bool SetZeroCopy(int32 sock_fd, bool on);
+
+  // Reads one MSG_ZEROCOPY completion from the error queue: the sends
+  // numbered [*lo, *hi] are done with their buffers, *copied tells if
+  // the kernel fell back to copying them.
+  // @return 1 if one was read, 0 if there is none left, -1 on error
+  int RecvZeroCopyCompletion(int32 sock_fd,
+                             uint32* lo, uint32* hi, bool* copied);
+
 }  // namespace cobra
 
 #endif  // COBRA_SOCKET_WRAPPER_H_
@@ -14,7 +14,7 @@ namespace cobra {
 namespace detail {
 
 void removeConnection(Worker* loop, const TcpConnectionPtr& conn) {
-  loop->queueInLoop(boost::bind(&TcpConnection::connectDestroyed, conn));
+  loop->queueInLoop(boost::bind(&TcpConnection::ConnectionDestroyed, conn));
 }
 
 void removeConnector(const ConnectorPtr& connector) {
@@ -55,7 +55,7 @@ TcpClient::~TcpClient() {
     // FIXME: not 100% safe, if we are in different thread
     CloseCb cb = boost::bind(&detail::removeConnection, loop_, _1);
     loop_->runInLoop(
-        boost::bind(&TcpConnection::setCloseCb, conn, cb));
+        boost::bind(&TcpConnection::SetCloseCb, conn, cb));
   } else {
     connector_->stop();
     // FIXME: HACK
@@ -63,6 +63,10 @@ TcpClient::~TcpClient() {
   }
 }
 
+void TcpClient::setConnectTimeout(double seconds) {
+  connector_->setConnectTimeout(seconds);
+}
+
 void TcpClient::connect() {
   // FIXME: check state
   LOG_INFO << "TcpClient::connect[" << name_ << "] - connecting to "
@@ -105,17 +109,17 @@ void TcpClient::newConnection(int sockfd) {
                                           localAddr,
                                           peerAddr));
 
-  conn->setConnectionCb(connectionCb_);
-  conn->setMessageCb(messageCb_);
-  conn->setWriteCompleteCb(writeCompleteCb_);
-  conn->setCloseCb(
+  conn->SetConnectionCb(connectionCb_);
+  conn->SetMessageCb(messageCb_);
+  conn->SetWriteCompleteCb(writeCompleteCb_);
+  conn->SetCloseCb(
       boost::bind(&TcpClient::removeConnection, this, _1)); // FIXME: unsafe
   {
     MutexLockGuard lock(mutex_);
     connection_ = conn;
   }
 
-  conn->connectEstablished();
+  conn->ConnectionEstablished();
 }
 
 void TcpClient::removeConnection(const TcpConnectionPtr& conn) {
@@ -128,7 +132,7 @@ void TcpClient::removeConnection(const TcpConnectionPtr& conn) {
     connection_.reset();
   }
 
-  loop_->queueInLoop(boost::bind(&TcpConnection::connectDestroyed, conn));
+  loop_->queueInLoop(boost::bind(&TcpConnection::ConnectionDestroyed, conn));
   if (retry_ && connect_)
   {
     LOG_INFO << "TcpClient::connect[" << name_ << "] - Reconnecting to "
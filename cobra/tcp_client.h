@@ -30,6 +30,10 @@ class TcpClient : boost::noncopyable {
   bool retry() const;
   void enableRetry() { retry_ = true; }
 
+  // @see Connector::setConnectTimeout.
+  // Must be called before connect.
+  void setConnectTimeout(double seconds);
+
   // Set connection callback.
   // Not thread safe.
   void setConnectionCb(const ConnectionCb& cb)
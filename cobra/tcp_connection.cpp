@@ -1,19 +1,21 @@
 #include "cobra/tcp_connection.h"
 
 #include "base/Logging.h"
-#include "cobra/channel.h"
+#include "cobra/connection_pool.h"
 #include "cobra/worker.h"
 #include "cobra/socket_wrapper.h"
+#include "cobra/zero_copy_linger.h"
+
+#include <algorithm>
 
 #include <boost/bind.hpp>
 
 #include <errno.h>
 #include <stdio.h>
+#include <unistd.h>
 
 namespace cobra {
 
-namespace {
-
 void defaultConnectionCb(const TcpConnectionPtr& conn) {
   LOG_TRACE << conn->localAddress().toIpPort() << " -> "
             << conn->peerAddress().toIpPort() << " is "
@@ -26,40 +28,138 @@ void defaultMessageCb(const TcpConnectionPtr&,
   buf->retrieveAll();
 }
 
+namespace {
+
+void deleteBuffer(Buffer* buf) {
+  delete buf;
+}
+
+// A block of the content of 'buf', which is left empty.
+BlockPtr takeBuffer(Buffer* buf) {
+  Buffer* content = new Buffer;
+  content->swap(*buf);
+  return BlockPtr(new Block(content->BeginRead(),
+                            content->readableBytes(),
+                            boost::bind(deleteBuffer, content)));
+}
+
+// A block of a copy of the data, for sending from other threads.
+BlockPtr copyToBlock(const void* data, size_t len) {
+  BlockPtr block(new Block(len));
+  block->append(data, len);
+  return block;
+}
+
 }  // Anonymous namespace
 
+const size_t TcpConnection::kEdgeTriggeredReadBudget;
+const size_t TcpConnection::kInputShrinkFactor;
+
 TcpConnection::TcpConnection(Worker* loop,
                              const string& connection_name,
                              int conn_fd,
                              const Endpoint& local_address,
                              const Endpoint& peer_address)
   : loop_(CHECK_NOTNULL(loop)),
+    id_(0),
     name_(connection_name),
     state_(kConnecting),
     conn_fd_(conn_fd),
-    channel_(new Channel(loop, conn_fd)),
+    channel_(loop, conn_fd),
     localAddr_(local_address),
     peerAddr_(peer_address),
-    highWaterMark_(64*1024*1024) {
+    highWaterMark_(64*1024*1024),
+    inputHighWaterMark_(0),
+    reading_(false),
+    autoCork_(false),
+    corked_(false),
+    zeroCopyEnabled_(false),
+    zeroCopyThreshold_(0),
+    completionIo_(loop->completionIo()),
+    sendInFlight_(false),
+    pool_(loop->connectionPool()),
+    inputBuffer_(pool_->takeBuffer()),
+    readSinceIdleCheck_(false),
+    reportedPendingBytes_(0),
+    idleRing_(NULL) {
+  init();
+}
+
+TcpConnection::TcpConnection(Worker* loop,
+                             uint64 id,
+                             const boost::shared_ptr<const string>& namePrefix,
+                             int conn_fd,
+                             const Endpoint& local_address,
+                             const Endpoint& peer_address)
+  : loop_(CHECK_NOTNULL(loop)),
+    id_(id),
+    namePrefix_(namePrefix),
+    state_(kConnecting),
+    conn_fd_(conn_fd),
+    channel_(loop, conn_fd),
+    localAddr_(local_address),
+    peerAddr_(peer_address),
+    highWaterMark_(64*1024*1024),
+    inputHighWaterMark_(0),
+    reading_(false),
+    autoCork_(false),
+    corked_(false),
+    zeroCopyEnabled_(false),
+    zeroCopyThreshold_(0),
+    completionIo_(loop->completionIo()),
+    sendInFlight_(false),
+    pool_(loop->connectionPool()),
+    inputBuffer_(pool_->takeBuffer()),
+    readSinceIdleCheck_(false),
+    reportedPendingBytes_(0),
+    idleRing_(NULL) {
+  init();
+}
+
+void TcpConnection::init() {
+  idleNode_.conn = this;
   // Set callbacks for Channel.
-  channel_->SetReadCb(
+  channel_.SetReadCb(
       boost::bind(&TcpConnection::handleRead, this, _1));
-  channel_->SetWriteCb(
+  channel_.SetWriteCb(
       boost::bind(&TcpConnection::handleWrite, this));
-  channel_->SetCloseCb(
+  channel_.SetCloseCb(
       boost::bind(&TcpConnection::handleClose, this));
-  channel_->SetErrorCb(
+  channel_.SetErrorCb(
       boost::bind(&TcpConnection::handleError, this));
+  if (completionIo_) {
+    channel_.SetRecvDoneCb(
+        boost::bind(&TcpConnection::handleRecvDone, this, _1, _2, _3));
+    channel_.SetSendDoneCb(
+        boost::bind(&TcpConnection::handleSendDone, this, _1));
+  }
   LOG_DEBUG << "TcpConnection::ctor[" <<  name_ << "] at " << this
-            << " fd=" << conn_fd;
+            << " id=" << id_ << " fd=" << conn_fd_;
 
   // Keep the conn-socket alive.
-  SetKeepAlive(conn_fd, true);
+  SetKeepAlive(conn_fd_, true);
+  loop_->addConnectionCount(1);
 }
 
 TcpConnection::~TcpConnection() {
-  LOG_DEBUG << "TcpConnection::dtor[" <<  name_ << "] at " << this
-            << " fd=" << channel_->fd();
+  LOG_DEBUG << "TcpConnection::dtor[" <<  name() << "] at " << this
+            << " fd=" << channel_.fd();
+  pool_->giveBuffer(inputBuffer_);
+  if (zeroCopyEnabled_) {
+    // No more zerocopy sends, and what completed since the last poll.
+    outputBuffer_.setZeroCopyThreshold(0);
+    handleZeroCopyCompletions();
+    if (outputBuffer_.pinnedBlocks() > 0) {
+      // The kernel still reads from them, they outlive us and the
+      // socket is closed once they're done.
+      boost::shared_ptr<BlockChain> pins(new BlockChain);
+      pins->takePins(&outputBuffer_);
+      loop_->zeroCopyLinger()->add(conn_fd_, pins);
+      return;
+    }
+  }
+  // The connection owns the socket.
+  cobra::close(conn_fd_);
 }
 
 void TcpConnection::send(const void* data, size_t len) {
@@ -67,11 +167,11 @@ void TcpConnection::send(const void* data, size_t len) {
     if (loop_->isInLoopThread()) {
       sendInLoop(data, len);
     } else {
-      string message(static_cast<const char*>(data), len);
+      // Copied once, the block is queued as is if needed.
       loop_->runInLoop(
-          boost::bind(&TcpConnection::sendInLoop,
+          boost::bind(&TcpConnection::sendBlockInLoop,
                       this,     // FIXME
-                      message));
+                      copyToBlock(data, len)));
     }
   }
 }
@@ -82,75 +182,326 @@ void TcpConnection::send(const StringPiece& message) {
       sendInLoop(message);
     } else {
       loop_->runInLoop(
-          boost::bind(&TcpConnection::sendInLoop,
+          boost::bind(&TcpConnection::sendBlockInLoop,
                       this,     // FIXME
-                      message.as_string()));
+                      copyToBlock(message.data(), message.size())));
     }
   }
 }
 
-// FIXME efficiency!!!
 void TcpConnection::send(Buffer* buf) {
   if (state_ == kConnected) {
     if (loop_->isInLoopThread()) {
+      if (zeroCopyThreshold_ > 0
+          && buf->readableBytes() >= zeroCopyThreshold_) {
+        // Worth taking it, instead of copying what can't go out now.
+        sendBlockInLoop(takeBuffer(buf));
+        return;
+      }
       sendInLoop(buf->BeginRead(), buf->readableBytes());
       buf->retrieveAll();
+    } else {
+      // Hand the content itself over to the loop.
+      loop_->runInLoop(
+          boost::bind(&TcpConnection::sendBlockInLoop,
+                      this,     // FIXME
+                      takeBuffer(buf)));
+    }
+  }
+}
+
+void TcpConnection::send(const BlockPtr& block) {
+  if (state_ == kConnected) {
+    if (loop_->isInLoopThread()) {
+      sendBlockInLoop(block);
     } else {
       loop_->runInLoop(
-          boost::bind(&TcpConnection::sendInLoop,
+          boost::bind(&TcpConnection::sendBlockInLoop,
                       this,     // FIXME
-                      buf->retrieveAllAsString()));
+                      block));
     }
   }
 }
 
+void TcpConnection::sendFile(int fd, off_t offset, size_t length) {
+  if (state_ == kConnected) {
+    // Our own descriptor, the caller may close theirs right away.
+    int fileFd = ::dup(fd);
+    if (fileFd < 0) {
+      LOG_SYSERR << "TcpConnection::sendFile";
+      return;
+    }
+    loop_->runInLoop(
+        boost::bind(&TcpConnection::sendFileInLoop,
+                    this,     // FIXME
+                    fileFd, offset, length));
+  }
+}
+
 void TcpConnection::sendInLoop(const StringPiece& message) {
   sendInLoop(message.data(), message.size());
 }
 
 void TcpConnection::sendInLoop(const void* data, size_t len) {
   loop_->assertInLoopThread();
-  ssize_t nwrote = 0;
-  size_t remaining = len;
-  bool faultError = false;
   if (state_ == kDisconnected) {
     LOG_WARN << "disconnected, give up writing";
     return;
   }
+
+  ssize_t nwrote = writeDirectly(data, len);
+  if (nwrote < 0) {
+    return;
+  }
+
+  // Put the data into output buffer.
+  size_t remaining = len - nwrote;
+  if (remaining > 0) {
+    checkHighWaterMark(remaining);
+    outputBuffer_.append(static_cast<const char*>(data) + nwrote, remaining);
+    reportPendingBytes();
+    enableWritingUnlessCorked();
+  }
+}
+
+void TcpConnection::sendBlockInLoop(const BlockPtr& block) {
+  loop_->assertInLoopThread();
+  if (state_ == kDisconnected) {
+    LOG_WARN << "disconnected, give up writing";
+    return;
+  }
+
+  if (zeroCopyThreshold_ > 0 && block->size() >= zeroCopyThreshold_) {
+    // Sent from the chain, which keeps the block until the kernel
+    // is done with it.
+    checkHighWaterMark(block->size());
+    outputBuffer_.append(block);
+    reportPendingBytes();
+    flushOrCork();
+    return;
+  }
+
+  ssize_t nwrote = writeDirectly(block->data(), block->size());
+  if (nwrote < 0) {
+    return;
+  }
+
+  // Queue the rest of the block itself.
+  size_t remaining = block->size() - nwrote;
+  if (remaining > 0) {
+    checkHighWaterMark(remaining);
+    outputBuffer_.append(block, nwrote, remaining);
+    reportPendingBytes();
+    enableWritingUnlessCorked();
+  }
+}
+
+void TcpConnection::sendFileInLoop(int fd, off_t offset, size_t length) {
+  loop_->assertInLoopThread();
+  if (state_ == kDisconnected) {
+    LOG_WARN << "disconnected, give up writing";
+    close(fd);
+    return;
+  }
+
+  checkHighWaterMark(length);
+  outputBuffer_.appendFile(fd, offset, length);
+  reportPendingBytes();
+  flushOrCork();
+}
+
+void TcpConnection::flushOrCork() {
+  if (channel_.isWriting() || corked_ || sendInFlight_) {
+    // Goes out after what is queued.
+    return;
+  }
+  if (autoCork_ || completionIo_) {
+    cork();
+  } else {
+    flushOutput();
+  }
+}
+
+ssize_t TcpConnection::writeDirectly(const void* data, size_t len) {
   // if no thing in output queue, try writing directly
-  if (!channel_->isWriting() && outputBuffer_.readableBytes() == 0) {
-    nwrote = write(channel_->fd(), data, len);
-    if (nwrote >= 0) {
-      remaining = len - nwrote;
-      if (remaining == 0 && writeCompleteCb_) {
-        loop_->queueInLoop(boost::bind(writeCompleteCb_, shared_from_this()));
-      }
-    } else {
-    // nwrote < 0
-      nwrote = 0;
-      if (errno != EWOULDBLOCK) {
-        LOG_SYSERR << "TcpConnection::sendInLoop";
-        if (errno == EPIPE || errno == ECONNRESET) // FIXME: any others?
-        {
-          faultError = true;
-        }
-      }
+  if (channel_.isWriting() || outputBuffer_.readableBytes() != 0) {
+    return 0;
+  }
+
+  if (autoCork_ || completionIo_) {
+    // Wait for the other sends of this iteration.
+    cork();
+    return 0;
+  }
+
+  ssize_t nwrote = write(channel_.fd(), data, len);
+  if (nwrote > 0) {
+    touchIdle();
+  }
+  if (nwrote >= 0) {
+    if (implicit_cast<size_t>(nwrote) == len && writeCompleteCb_) {
+      loop_->queueInLoop(boost::bind(writeCompleteCb_, shared_from_this()));
     }
+    return nwrote;
   }
 
-  // Put the data into output buffer.
-  if (!faultError && remaining > 0) {
-    size_t oldLen = outputBuffer_.readableBytes();
-    if (oldLen + remaining >= highWaterMark_
-        && oldLen < highWaterMark_
-        && highWaterMarkCb_) {
-      loop_->queueInLoop(boost::bind(highWaterMarkCb_, shared_from_this(), oldLen + remaining));
+  // nwrote < 0
+  if (errno != EWOULDBLOCK) {
+    LOG_SYSERR << "TcpConnection::sendInLoop";
+    if (errno == EPIPE || errno == ECONNRESET) // FIXME: any others?
+    {
+      return -1;
     }
-    outputBuffer_.append(static_cast<const char*>(data) + nwrote, remaining);
-    if (!channel_->isWriting()) {
-      channel_->enableWriting();
+  }
+  return 0;
+}
+
+void TcpConnection::checkHighWaterMark(size_t len) {
+  size_t oldLen = outputBuffer_.readableBytes();
+  if (oldLen + len >= highWaterMark_
+      && oldLen < highWaterMark_
+      && highWaterMarkCb_) {
+    loop_->queueInLoop(boost::bind(highWaterMarkCb_, shared_from_this(), oldLen + len));
+  }
+}
+
+void TcpConnection::cork() {
+  if (!corked_) {
+    corked_ = true;
+    loop_->runBeforePoll(
+        boost::bind(&TcpConnection::flushCorked, shared_from_this()));
+  }
+}
+
+void TcpConnection::enableWritingUnlessCorked() {
+  if (!channel_.isWriting() && !corked_ && !sendInFlight_) {
+    channel_.enableWriting();
+  }
+}
+
+void TcpConnection::flushCorked() {
+  loop_->assertInLoopThread();
+  corked_ = false;
+  if (state_ == kDisconnected || channel_.isWriting() || sendInFlight_) {
+    return;
+  }
+
+  flushOutput();
+}
+
+void TcpConnection::flushOutput() {
+  if (completionIo_ && !outputBuffer_.empty() && !outputBuffer_.fileFirst()) {
+    // Goes out along with the next wait of the loop, file regions still
+    // wait for the socket to be writable.
+    if (channel_.isWriting()) {
+      channel_.disableWriting();
+    }
+    submitOutput();
+    return;
+  }
+
+  int savedErrno = 0;
+  ssize_t n = 0;
+  bool wrote = false;
+  while (!outputBuffer_.empty()) {
+    n = outputBuffer_.writeFd(channel_.fd(), &savedErrno);
+    if (n > 0) {
+      wrote = true;
+    }
+    // In edge-triggered mode we are only told again once the socket
+    // got full, so keep going until it is.
+    if (n <= 0 || !channel_.edgeTriggered()) {
+      break;
     }
   }
+  reportPendingBytes();
+  if (wrote) {
+    touchIdle();
+  }
+
+  if (outputBuffer_.empty()) {
+    if (channel_.isWriting()) {
+      channel_.disableWriting();
+    }
+    if (wrote && writeCompleteCb_) {
+      loop_->queueInLoop(boost::bind(writeCompleteCb_, shared_from_this()));
+    }
+    if (state_ == kDisconnecting) {
+      shutdownInLoop();
+    }
+    return;
+  }
+
+  if (n < 0 && savedErrno != EWOULDBLOCK && savedErrno != EINTR) {
+    errno = savedErrno;
+    LOG_SYSERR << "TcpConnection::flushOutput";
+    // The rest can't go out, and the peer must not wait for it.
+    outputBuffer_.retrieveAll();
+    reportPendingBytes();
+    if (channel_.isWriting()) {
+      channel_.disableWriting();
+    }
+    ShutdownWrite(conn_fd_);
+    return;
+  }
+
+  if (!channel_.isWriting()) {
+    channel_.enableWriting();
+  }
+}
+
+void TcpConnection::submitOutput() {
+  iovec vec[BlockChain::kMaxIovecs];
+  const int iovcnt = outputBuffer_.peek(vec, BlockChain::kMaxIovecs);
+  sendInFlight_ = true;
+  // The blocks stay in the output buffer until handleSendDone retrieves
+  // them, the poller keeps us alive until then.
+  loop_->submitSend(&channel_, vec, iovcnt, shared_from_this());
+}
+
+void TcpConnection::handleSendDone(ssize_t n) {
+  loop_->assertInLoopThread();
+  sendInFlight_ = false;
+  if (n > 0) {
+    outputBuffer_.retrieve(implicit_cast<size_t>(n));
+    reportPendingBytes();
+  }
+  if (state_ == kDisconnected) {
+    return;
+  }
+
+  if (n < 0) {
+    errno = static_cast<int>(-n);
+    LOG_SYSERR << "TcpConnection::handleSendDone";
+    // The rest can't go out, and the peer must not wait for it.
+    outputBuffer_.retrieveAll();
+    reportPendingBytes();
+    ShutdownWrite(conn_fd_);
+    return;
+  }
+  if (n > 0) {
+    touchIdle();
+  }
+
+  if (outputBuffer_.empty()) {
+    if (writeCompleteCb_) {
+      loop_->queueInLoop(boost::bind(writeCompleteCb_, shared_from_this()));
+    }
+    if (state_ == kDisconnecting) {
+      shutdownInLoop();
+    }
+    return;
+  }
+  // What was queued meanwhile.
+  flushOutput();
+}
+
+void TcpConnection::reportPendingBytes() {
+  const int64 pending = implicit_cast<int64>(outputBuffer_.readableBytes());
+  if (pending != reportedPendingBytes_) {
+    loop_->addPendingBytes(pending - reportedPendingBytes_);
+    reportedPendingBytes_ = pending;
+  }
 }
 
 void TcpConnection::shutdown() {
@@ -163,10 +514,80 @@ void TcpConnection::shutdown() {
   }
 }
 
+void TcpConnection::forceClose() {
+  if (state_ == kConnected || state_ == kDisconnecting) {
+    loop_->runInLoop(boost::bind(&TcpConnection::forceCloseInLoop,
+                                 shared_from_this()));
+  }
+}
+
+void TcpConnection::forceCloseInLoop() {
+  loop_->assertInLoopThread();
+  if (state_ == kConnected || state_ == kDisconnecting) {
+    // As if the peer closed.
+    handleClose();
+  }
+}
+
+void TcpConnection::startRead() {
+  loop_->runInLoop(boost::bind(&TcpConnection::startReadInLoop,
+                               shared_from_this()));
+}
+
+void TcpConnection::stopRead() {
+  loop_->runInLoop(boost::bind(&TcpConnection::stopReadInLoop,
+                               shared_from_this()));
+}
+
+void TcpConnection::startReadInLoop() {
+  loop_->assertInLoopThread();
+  if (reading_ || (state_ != kConnected && state_ != kDisconnecting)) {
+    return;
+  }
+  if (inputHighWaterMark_ > 0
+      && inputBuffer_->readableBytes() >= inputHighWaterMark_) {
+    LOG_DEBUG << "TcpConnection::startReadInLoop [" << name()
+              << "] - input buffer still above the high water mark";
+    return;
+  }
+
+  reading_ = true;
+  channel_.enableReading();
+  if (channel_.edgeTriggered()) {
+    // We won't be told about what is already in the socket.
+    loop_->queueInLoop(boost::bind(&TcpConnection::handleReadUntilAgain,
+                                   shared_from_this(),
+                                   Timestamp::now()));
+  }
+  if (resumeReadCb_) {
+    resumeReadCb_(shared_from_this());
+  }
+}
+
+void TcpConnection::stopReadInLoop() {
+  loop_->assertInLoopThread();
+  if (!reading_ || (state_ != kConnected && state_ != kDisconnecting)) {
+    return;
+  }
+  reading_ = false;
+  channel_.disableReading();
+}
+
+void TcpConnection::checkInputHighWaterMark() {
+  const size_t readable = inputBuffer_->readableBytes();
+  if (inputHighWaterMark_ > 0 && readable >= inputHighWaterMark_
+      && reading_ && (state_ == kConnected || state_ == kDisconnecting)) {
+    stopReadInLoop();
+    if (inputHighWaterMarkCb_) {
+      inputHighWaterMarkCb_(shared_from_this(), readable);
+    }
+  }
+}
+
 void TcpConnection::shutdownInLoop()
 {
   loop_->assertInLoopThread();
-  if (!channel_->isWriting())
+  if (!channel_.isWriting() && !corked_ && !sendInFlight_)
   {
     // we are not writing
     ShutdownWrite(conn_fd_);
@@ -177,17 +598,34 @@ void TcpConnection::setTcpNoDelay(bool on) {
   SetTcpNoDelay(conn_fd_, on);
 }
 
+void TcpConnection::setEdgeTriggered(bool on) {
+  assert(state_ == kConnecting);
+  if (!completionIo_) {
+    channel_.setEdgeTriggered(on);
+  }
+}
+
 // Called when the connetion on the corresponding conn socket is established.
 void TcpConnection::ConnectionEstablished() {
   loop_->assertInLoopThread();
   assert(state_ == kConnecting);
+  if (name_.empty() && namePrefix_) {
+    // Before anyone else sees the connection, name() is then a plain
+    // read in any thread.
+    char buf[32];
+    snprintf(buf, sizeof buf, "%llu", static_cast<unsigned long long>(id_));
+    name_ = *namePrefix_ + buf;
+  }
   setState(kConnected);
-  channel_->tie(shared_from_this());
+  channel_.tie(shared_from_this());
+
+  touchIdle();
 
+  reading_ = true;
   // Enable the 'read' event on the conn socket, which means
   // when a reading event happens on the conn socket, the corresponding
   // callback function will be called.
-  channel_->enableReading();
+  channel_.enableReading();
 
   // This cb function is set by user, @see TcpServer::SetConnectionCallBack().
   connectionCb_(shared_from_this());
@@ -197,26 +635,43 @@ void TcpConnection::ConnectionDestroyed() {
   loop_->assertInLoopThread();
   if (state_ == kConnected) {
     setState(kDisconnected);
-    channel_->disableAll();
+    channel_.disableAll();
 
     connectionCb_(shared_from_this());
   }
-  channel_->remove();
+  if (idleRing_ != NULL) {
+    idleRing_->remove(&idleNode_);
+  }
+  channel_.remove();
+
+  // Off the load counters of the loop now, a user may keep the
+  // connection after its Worker is gone.
+  loop_->addPendingBytes(-reportedPendingBytes_);
+  reportedPendingBytes_ = 0;
+  loop_->addConnectionCount(-1);
 }
 
 // Called when read event happens on the conn socket.
 // 'Read' means reading message from tcp client into the input_buffer.
 void TcpConnection::handleRead(Timestamp receiveTime) {
   loop_->assertInLoopThread();
+  if (channel_.edgeTriggered()) {
+    handleReadUntilAgain(receiveTime);
+    return;
+  }
+
   int savedErrno = 0;
 
-  // here, channel_->fd() refers to the conn socket.
+  // here, channel_.fd() refers to the conn socket.
   // Read message from the tcp client and put it into the input buffer,
   // then call the 'MessageCallBack' callback function to handle the message.
-  ssize_t n = inputBuffer_.readFd(channel_->fd(), &savedErrno);
+  ssize_t n = readInput(&savedErrno);
   if (n > 0) {
+    touchIdle();
     // Now, the message passed from tcp client has been stored in the input buffer.
-    messageCb_(shared_from_this(), &inputBuffer_, receiveTime);
+    messageCb_(shared_from_this(), inputBuffer_, receiveTime);
+    checkInputHighWaterMark();
+    shrinkInputIfEmpty();
   } else if (n == 0) {
     handleClose();
   } else {
@@ -226,43 +681,142 @@ void TcpConnection::handleRead(Timestamp receiveTime) {
   }
 }
 
-void TcpConnection::handleWrite() {
+// Completion-based version of handleRead, the poller received 'data'.
+void TcpConnection::handleRecvDone(const char* data,
+                                   ssize_t n,
+                                   Timestamp receiveTime) {
   loop_->assertInLoopThread();
-  if (channel_->isWriting()) {
-    ssize_t n = write(channel_->fd(),
-                               outputBuffer_.BeginRead(),
-                               outputBuffer_.readableBytes());
-    if (n > 0) {
-      outputBuffer_.retrieve(n);
-      if (outputBuffer_.readableBytes() == 0) {
-        channel_->disableWriting();
-        if (writeCompleteCb_) {
-          loop_->queueInLoop(boost::bind(writeCompleteCb_, shared_from_this()));
-        }
-        if (state_ == kDisconnecting) {
-          shutdownInLoop();
-        }
-      }
-    } else {
-      LOG_SYSERR << "TcpConnection::handleWrite";
-      // if (state_ == kDisconnecting)
-      // {
-      //   shutdownInLoop();
-      // }
+  if (state_ != kConnected && state_ != kDisconnecting) {
+    // Closed by the events handled before.
+    return;
+  }
+
+  if (n > 0) {
+    inputBuffer_->append(data, implicit_cast<size_t>(n));
+    readSinceIdleCheck_ = true;
+    touchIdle();
+    messageCb_(shared_from_this(), inputBuffer_, receiveTime);
+    checkInputHighWaterMark();
+    shrinkInputIfEmpty();
+  } else if (n == 0) {
+    handleClose();
+  } else {
+    errno = static_cast<int>(-n);
+    LOG_SYSERR << "TcpConnection::handleRecvDone";
+    handleError();
+  }
+}
+
+// Edge-triggered version of handleRead, we won't be told again about
+// what we leave in the socket.
+void TcpConnection::handleReadUntilAgain(Timestamp receiveTime) {
+  loop_->assertInLoopThread();
+  if (state_ == kDisconnected || !reading_) {
+    // Closed or stopped before a resumed read got its turn.
+    return;
+  }
+
+  size_t total = 0;
+  ssize_t n = 0;
+  int savedErrno = 0;
+  while (total < kEdgeTriggeredReadBudget) {
+    n = readInput(&savedErrno);
+    if (n <= 0) {
+      break;
+    }
+    total += implicit_cast<size_t>(n);
+    if (inputHighWaterMark_ > 0
+        && inputBuffer_->readableBytes() >= inputHighWaterMark_) {
+      // Let the message callback consume it first.
+      break;
+    }
+  }
+
+  if (total > 0) {
+    touchIdle();
+    messageCb_(shared_from_this(), inputBuffer_, receiveTime);
+    checkInputHighWaterMark();
+    shrinkInputIfEmpty();
+  }
+
+  if (n > 0) {
+    if (!reading_) {
+      // Left in the socket, startRead reads it.
+      return;
+    }
+    // Budget used up, give the other connections a chance and resume
+    // after them.
+    loop_->queueInLoop(boost::bind(&TcpConnection::handleReadUntilAgain,
+                                   shared_from_this(), receiveTime));
+  } else if (n == 0) {
+    if (state_ != kDisconnected) {
+      handleClose();
     }
+  } else if (savedErrno != EAGAIN && savedErrno != EWOULDBLOCK) {
+    errno = savedErrno;
+    LOG_SYSERR << "TcpConnection::handleReadUntilAgain";
+    handleError();
+  }
+}
+
+ssize_t TcpConnection::readInput(int* savedErrno) {
+  size_t len = readSizer_.next();
+  const size_t readable = inputBuffer_->readableBytes();
+  if (inputHighWaterMark_ > 0 && readable < inputHighWaterMark_) {
+    // Stop right at the mark.
+    len = std::min(len, inputHighWaterMark_ - readable);
+  }
+  ssize_t n = inputBuffer_->readFd(channel_.fd(), len, savedErrno);
+  if (n > 0) {
+    readSizer_.record(implicit_cast<size_t>(n));
+    readSinceIdleCheck_ = true;
+  }
+  return n;
+}
+
+void TcpConnection::shrinkInputIfEmpty() {
+  if (inputBuffer_->readableBytes() == 0
+      && inputBuffer_->internalCapacity()
+         > kInputShrinkFactor * std::max(readSizer_.next(),
+                                         Buffer::kInitialSize)) {
+    inputBuffer_->shrink(0);
+  }
+}
+
+void TcpConnection::shrinkInputIfIdle() {
+  loop_->assertInLoopThread();
+  if (readSinceIdleCheck_) {
+    readSinceIdleCheck_ = false;
+    return;
+  }
+  readSizer_.reset();
+  if (inputBuffer_->readableBytes() == 0
+      && inputBuffer_->internalCapacity()
+         > Buffer::kCheapPrepend + Buffer::kInitialSize) {
+    inputBuffer_->shrink(0);
+  }
+}
+
+void TcpConnection::handleWrite() {
+  loop_->assertInLoopThread();
+  if (channel_.isWriting()) {
+    flushOutput();
   } else {
-    LOG_TRACE << "Connection fd = " << channel_->fd()
+    LOG_TRACE << "Connection fd = " << channel_.fd()
               << " is down, no more writing";
   }
 }
 
 void TcpConnection::handleClose() {
   loop_->assertInLoopThread();
-  LOG_TRACE << "fd = " << channel_->fd() << " state = " << state_;
+  LOG_TRACE << "fd = " << channel_.fd() << " state = " << state_;
   assert(state_ == kConnected || state_ == kDisconnecting);
   // we don't close fd, leave it to dtor, so we can find leaks easily.
   setState(kDisconnected);
-  channel_->disableAll();
+  channel_.disableAll();
+  if (idleRing_ != NULL) {
+    idleRing_->remove(&idleNode_);
+  }
 
   TcpConnectionPtr guardThis(shared_from_this());
   connectionCb_(guardThis);
@@ -270,9 +824,52 @@ void TcpConnection::handleClose() {
   closeCb_(guardThis);
 }
 
+void TcpConnection::setZeroCopyThreshold(size_t threshold) {
+  if (completionIo_) {
+    // The poller sends, without MSG_ZEROCOPY.
+    return;
+  }
+  if (threshold > 0 && !zeroCopyEnabled_) {
+    zeroCopyEnabled_ = SetZeroCopy(conn_fd_, true);
+    if (!zeroCopyEnabled_) {
+      return;
+    }
+  }
+  zeroCopyThreshold_ = threshold;
+  outputBuffer_.setZeroCopyThreshold(threshold);
+}
+
+void TcpConnection::handleZeroCopyCompletions() {
+  uint32 lo = 0;
+  uint32 hi = 0;
+  bool copied = false;
+  int ret = 0;
+  while ((ret = RecvZeroCopyCompletion(conn_fd_, &lo, &hi, &copied)) > 0) {
+    outputBuffer_.zeroCopyCompleted(lo, hi);
+    if (copied && zeroCopyThreshold_ > 0) {
+      // eg. loopback, we would only pay for the notifications.
+      LOG_DEBUG << "TcpConnection::handleZeroCopyCompletions [" << name()
+                << "] - copied by the kernel, zerocopy disabled";
+      zeroCopyThreshold_ = 0;
+      outputBuffer_.setZeroCopyThreshold(0);
+    }
+  }
+  if (ret < 0) {
+    LOG_SYSERR << "TcpConnection::handleZeroCopyCompletions";
+  }
+}
+
 void TcpConnection::handleError() {
-  int err = getSocketError(channel_->fd());
-  LOG_ERROR << "TcpConnection::handleError [" << name_
+  if (zeroCopyEnabled_) {
+    // Completions are reported through the error queue.
+    handleZeroCopyCompletions();
+  }
+
+  int err = getSocketError(channel_.fd());
+  if (err == 0 && zeroCopyEnabled_) {
+    return;
+  }
+  LOG_ERROR << "TcpConnection::handleError [" << name()
             << "] - SO_ERROR = " << err << " " << strerror_tl(err);
 }
 
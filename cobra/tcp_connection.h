@@ -3,7 +3,6 @@
 
 #include <boost/any.hpp>
 #include <boost/enable_shared_from_this.hpp>
-#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include "base/basic_types.h"
@@ -11,12 +10,16 @@
 #include "base/string_piece.h"
 #include "base/Types.h"
 #include "cobra/callbacks.h"
+#include "cobra/block_chain.h"
 #include "cobra/buffer.h"
+#include "cobra/channel.h"
 #include "cobra/endpoint.h"
+#include "cobra/idle_ring.h"
+#include "cobra/read_sizer.h"
 
 namespace cobra {
 
-class Channel;
+class ConnectionPool;
 class Worker;
 class Socket;
 
@@ -28,20 +31,84 @@ class TcpConnection : public boost::enable_shared_from_this<TcpConnection> {
                 int sockfd,
                 const Endpoint& localAddr,
                 const Endpoint& peerAddr);
+  // Named "<namePrefix><id>" by ConnectionEstablished, in the loop of
+  // the connection, so that accepting doesn't pay for formatting it.
+  TcpConnection(Worker* loop,
+                uint64 id,
+                const boost::shared_ptr<const string>& namePrefix,
+                int sockfd,
+                const Endpoint& localAddr,
+                const Endpoint& peerAddr);
   ~TcpConnection();
 
   Worker* getLoop() const { return loop_; }
+  // 0 for connections constructed with a name.
+  uint64 id() const { return id_; }
+  // Empty for connections with an id until they are established, set
+  // before any callback sees them.
   const string& name() const { return name_; }
   const Endpoint& localAddress() { return localAddr_; }
   const Endpoint& peerAddress() { return peerAddr_; }
   bool connected() const { return state_ == kConnected; }
 
+  // Thread safe, from other threads the message is copied once.
   void send(const void* message, size_t len);
   void send(const StringPiece& message);
-  void send(Buffer* message);  // this one will swap data
+  // This one will swap data: from other threads the content of the
+  // buffer is handed over to the loop without a copy, and 'message'
+  // is left empty.
+  void send(Buffer* message);
+  // Queues the block itself if it can't be written right away, the
+  // caller must not modify it until released.
+  void send(const BlockPtr& block);
+  // Sends 'length' bytes of the file from 'offset' with sendfile(2) as
+  // the socket becomes writable, after what is already queued. The file
+  // counts against the high water mark until sent, the write complete
+  // callback runs once it's all gone. 'fd' is dup'ed, the caller may
+  // close it right away but must not truncate the file meanwhile.
+  void sendFile(int fd, off_t offset, size_t length);
   void shutdown(); // NOT thread safe, no simultaneous calling
+  // Closes right away, dropping what is not sent yet.
+  // Thread safe.
+  void forceClose();
   void setTcpNoDelay(bool on);
 
+  // Read-side backpressure: stops reading the socket, the peer then
+  // fills the TCP window and eventually stops sending. startRead
+  // resumes, unless the input buffer is still above the input high
+  // water mark.
+  // Thread safe.
+  void startRead();
+  void stopRead();
+  // Must be called in the loop thread.
+  bool isReading() const { return reading_; }
+
+  // Edge-triggered mode, @see Channel::setEdgeTriggered.
+  // Each readable event drains the socket until EAGAIN, up to
+  // kEdgeTriggeredReadBudget bytes, the rest is read after the other
+  // connections of the loop had their turn. Ignored if the loop does
+  // completion-based I/O, which has no readiness to trigger on.
+  // Must be called before ConnectionEstablished.
+  void setEdgeTriggered(bool on);
+
+  // Auto-cork mode: sends made in the loop thread are not written right
+  // away but gathered until the end of the loop iteration, and flushed
+  // with one writev(2). A reply sent in pieces then costs one syscall
+  // (and ideally goes out in one segment).
+  // Always the case if the loop does completion-based I/O, the batch is
+  // then submitted along with the next wait of the loop.
+  // Must be called before ConnectionEstablished, or in the loop thread.
+  void setAutoCork(bool on) { autoCork_ = on; }
+
+  // Sends blocks (and buffers) of at least 'threshold' bytes with
+  // MSG_ZEROCOPY, 0 disables it. They stay referenced until the kernel
+  // reports it's done with them. Left disabled if the socket doesn't
+  // support it, and dropped once the kernel reports having copied
+  // anyway (eg. on loopback). Data sent by pointer is still copied.
+  // Ignored if the loop does completion-based I/O.
+  // Must be called before ConnectionEstablished, or in the loop thread.
+  void setZeroCopyThreshold(size_t threshold);
+
   void setContext(const boost::any& context) {
     context_ = context;
   }
@@ -78,18 +145,47 @@ class TcpConnection : public boost::enable_shared_from_this<TcpConnection> {
     highWaterMark_ = highWaterMark;
   }
 
+  // Stops reading once the message callback leaves at least
+  // 'highWaterMark' bytes in the input buffer, and calls 'cb', which
+  // bounds the memory of a connection whose consumer lags behind.
+  // Consume the buffer then call startRead to resume. 0 (the default)
+  // never stops.
+  void setInputHighWaterMarkCb(const HighWaterMarkCb& cb,
+                               size_t highWaterMark) {
+    inputHighWaterMarkCb_ = cb;
+    inputHighWaterMark_ = highWaterMark;
+  }
+
+  // Called when reading resumes, @see startRead.
+  void setResumeReadCb(const ResumeReadCb& cb) {
+    resumeReadCb_ = cb;
+  }
+
   /// Advanced interface
   Buffer* inputBuffer() {
-    return &inputBuffer_;
+    return inputBuffer_;
   }
 
-  Buffer* outputBuffer() {
+  BlockChain* outputBuffer() {
     return &outputBuffer_;
   }
 
   // Internal use only.
   void SetCloseCb(const CloseCb& cb) { closeCb_ = cb; }
 
+  // Closes the connection once idle for the timeout of 'ring',
+  // @see Server::SetIdleTimeout.
+  // Must be called in the loop thread, before ConnectionEstablished.
+  void setIdleRing(IdleRing* ring) { idleRing_ = ring; }
+
+  // Not thread safe, but in the loop
+  //
+  // Resets the read size and gives an empty input buffer back down to
+  // its initial size, unless something was read since the last call.
+  // Called every few seconds by the server, so that a connection going
+  // quiet after a burst doesn't keep its large buffer.
+  void shrinkInputIfIdle();
+
   // Called when TcpServer accepts a new connection
   void ConnectionEstablished();   // should be called only once
   // Called when TcpServer has removed me from its map
@@ -97,30 +193,111 @@ class TcpConnection : public boost::enable_shared_from_this<TcpConnection> {
 
  private:
   enum StateE { kDisconnected, kConnecting, kConnected, kDisconnecting };
+
+  // The max bytes read by one handleRead in edge-triggered mode.
+  static const size_t kEdgeTriggeredReadBudget = 256 * 1024;
+  // An empty input buffer larger than this many times the read size is
+  // given back, so that idle connections stay small.
+  static const size_t kInputShrinkFactor = 4;
+
   void handleRead(Timestamp receiveTime);
+  void handleReadUntilAgain(Timestamp receiveTime);
   void handleWrite();
+  // Completion-based I/O, @see Channel::SetRecvDoneCb.
+  void handleRecvDone(const char* data, ssize_t n, Timestamp receiveTime);
+  void handleSendDone(ssize_t n);
+  // Hands the blocks first in the output buffer to the poller.
+  void submitOutput();
   void handleClose();
   void handleError();
   void sendInLoop(const StringPiece& message);
   void sendInLoop(const void* message, size_t len);
+  void sendBlockInLoop(const BlockPtr& block);
+  void sendFileInLoop(int fd, off_t offset, size_t length);
+  // Writes right away if nothing is queued.
+  // @return the bytes written, -1 on a fatal error
+  ssize_t writeDirectly(const void* data, size_t len);
+  // Called before queueing 'len' more bytes.
+  void checkHighWaterMark(size_t len);
+  // Starts writing what's left in the output buffer.
+  void enableWritingUnlessCorked();
+  // Writes what is queued, then either completes or waits for the
+  // socket to be writable.
+  void flushOutput();
+  // Schedules a flushCorked, @see setAutoCork.
+  void cork();
+  // Flushes right away unless writing is pending or corked.
+  void flushOrCork();
+  // Reads the MSG_ZEROCOPY completions from the error queue.
+  void handleZeroCopyCompletions();
+  // Run by the loop before it polls again, @see setAutoCork.
+  void flushCorked();
+  // Brings the pending bytes of the loop up to date with the output
+  // buffer, @see Worker::pendingBytes.
+  void reportPendingBytes();
   void shutdownInLoop();
+  void forceCloseInLoop();
+  void startReadInLoop();
+  void stopReadInLoop();
+  // Stops reading if the input buffer reached the high water mark.
+  void checkInputHighWaterMark();
+  // Reads into the input buffer, sized by 'readSizer_'.
+  ssize_t readInput(int* savedErrno);
+  // Run after the message callback.
+  void shrinkInputIfEmpty();
+  // Some bytes came in or went out.
+  void touchIdle() {
+    if (idleRing_ != NULL) {
+      idleRing_->touch(&idleNode_);
+    }
+  }
   void setState(StateE s) { state_ = s; }
+  void init();
 
   Worker* loop_;
+  const uint64 id_;
+  boost::shared_ptr<const string> namePrefix_;
   string name_;
   StateE state_;  // FIXME: use atomic variable
   int32 conn_fd_;
-  boost::scoped_ptr<Channel> channel_;
+  // Embedded, it shares the (pooled) allocation of the connection.
+  Channel channel_;
   Endpoint localAddr_;
   Endpoint peerAddr_;
   ConnectionCb connectionCb_;
   MessageCb messageCb_;
   WriteCompleteCb writeCompleteCb_;
   HighWaterMarkCb highWaterMarkCb_;
+  HighWaterMarkCb inputHighWaterMarkCb_;
+  ResumeReadCb resumeReadCb_;
   CloseCb closeCb_;
   size_t highWaterMark_;
-  Buffer inputBuffer_;
-  Buffer outputBuffer_; // FIXME: use list<Buffer> as output buffer.
+  size_t inputHighWaterMark_;
+  // Reading the socket, unless stopped.
+  bool reading_;
+  bool autoCork_;
+  // A flushCorked is scheduled.
+  bool corked_;
+  // SO_ZEROCOPY is set on the socket.
+  bool zeroCopyEnabled_;
+  size_t zeroCopyThreshold_;
+  // The poller of the loop receives and sends for us,
+  // @see Poller::completionIo.
+  bool completionIo_;
+  // A submitOutput didn't complete yet.
+  bool sendInFlight_;
+  // The pool of the loop, which may be gone when we are.
+  boost::shared_ptr<ConnectionPool> pool_;
+  // From 'pool_'.
+  Buffer* inputBuffer_;
+  ReadSizer readSizer_;
+  // Something was read since the last shrinkInputIfIdle.
+  bool readSinceIdleCheck_;
+  BlockChain outputBuffer_;
+  // What the loop last heard of outputBuffer_.readableBytes().
+  int64 reportedPendingBytes_;
+  IdleRing* idleRing_;
+  IdleRing::Node idleNode_;
   boost::any context_;
   // FIXME: creationTime_, lastReceiveTime_
   //        bytesReceived_, bytesSent_
@@ -1,28 +1,34 @@
 #ifndef COBRA_TIMERID_H_
 #define COBRA_TIMERID_H_
 
-namespace cobra {
+#include "base/basic_types.h"
 
-class Timer;
+namespace cobra {
 
 // An opaque identifier, for canceling Timer.
+//
+// Names a slot of the timer pool of the owning loop, and the generation
+// of that slot when the timer was added. The generation is bumped when
+// the timer is gone, so a stale id simply doesn't match any more.
 class TimerId {
  public:
   TimerId()
-    : timer_(NULL),
-      sequence_(0) {
+    : index_(0),
+      generation_(0) {
   }
 
-  TimerId(Timer* timer, int64_t seq)
-    : timer_(timer),
-      sequence_(seq) {
+  TimerId(uint32 index, uint32 generation)
+    : index_(index),
+      generation_(generation) {
   }
 
   friend class TimerQueue;
+  friend class TimerWheel;
 
  private:
-  Timer* timer_;
-  int64_t sequence_;
+  uint32 index_;
+  // 0 is never a valid generation.
+  uint32 generation_;
 };
 
 }  // namespace cobra
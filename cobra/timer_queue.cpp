@@ -1,68 +1,15 @@
 #include "cobra/timer_queue.h"
 
-#include <sys/timerfd.h>
-
 #include <boost/bind.hpp>
 
 #include "base/Logging.h"
 #include "cobra/worker.h"
 #include "cobra/timer.h"
 #include "cobra/timer_id.h"
+#include "cobra/timerfd.h"
 
 namespace cobra {
 
-namespace {
-
-int createTimerfd() {
-  int timerfd = ::timerfd_create(CLOCK_MONOTONIC,
-                                 TFD_NONBLOCK | TFD_CLOEXEC);
-  if (timerfd < 0) {
-    LOG_SYSFATAL << "Failed in timerfd_create";
-  }
-
-  return timerfd;
-}
-
-timespec howMuchTimeFromNow(Timestamp when) {
-  int64_t microseconds = when.microSecondsSinceEpoch()
-                         - Timestamp::now().microSecondsSinceEpoch();
-  if (microseconds < 100) {
-    microseconds = 100;
-  }
-
-  timespec ts;
-  ts.tv_sec = static_cast<time_t>(
-      microseconds / Timestamp::kMicroSecondsPerSecond);
-  ts.tv_nsec = static_cast<long>(
-      (microseconds % Timestamp::kMicroSecondsPerSecond) * 1000);
-
-  return ts;
-}
-
-void readTimerfd(int timerfd, Timestamp now) {
-  uint64_t howmany;
-  ssize_t n = ::read(timerfd, &howmany, sizeof howmany);
-  LOG_TRACE << "TimerQueue::handleRead() " << howmany << " at " << now.toString();
-  if (n != sizeof howmany) {
-    LOG_ERROR << "TimerQueue::handleRead() reads " << n << " bytes instead of 8";
-  }
-}
-
-void resetTimerfd(int timerfd, Timestamp expiration) {
-  // wake up loop by timerfd_settime()
-   itimerspec newValue;
-   itimerspec oldValue;
-  bzero(&newValue, sizeof newValue);
-  bzero(&oldValue, sizeof oldValue);
-  newValue.it_value = howMuchTimeFromNow(expiration);
-  int ret = ::timerfd_settime(timerfd, 0, &newValue, &oldValue);
-  if (ret) {
-    LOG_SYSERR << "timerfd_settime()";
-  }
-}
-
-}  // Anonymous namespace
-
 TimerQueue::TimerQueue(Worker* loop)
   : loop_(loop),
     timerfd_(createTimerfd()),
@@ -80,17 +27,19 @@ TimerQueue::~TimerQueue() {
   // do not remove channel, since we're in Worker::dtor();
   for (TimerList::iterator it = timers_.begin();
       it != timers_.end(); ++it) {
-    delete it->second;
+    pool_.release(it->second);
   }
 }
 
 TimerId TimerQueue::addTimer(const TimerCb& cb,
                              Timestamp when,
                              double interval) {
-  Timer* timer = new Timer(cb, when, interval);
+  uint32 generation = 0;
+  uint32 index = pool_.acquire(&generation);
+  new (pool_.storage(index)) Timer(cb, when, interval);
   loop_->runInLoop(
-      boost::bind(&TimerQueue::addTimerInLoop, this, timer));
-  return TimerId(timer, timer->sequence());
+      boost::bind(&TimerQueue::addTimerInLoop, this, index));
+  return TimerId(index, generation);
 }
 
 void TimerQueue::cancel(TimerId timerId) {
@@ -98,29 +47,29 @@ void TimerQueue::cancel(TimerId timerId) {
       boost::bind(&TimerQueue::cancelInLoop, this, timerId));
 }
 
-void TimerQueue::addTimerInLoop(Timer* timer) {
+void TimerQueue::addTimerInLoop(uint32 index) {
   loop_->assertInLoopThread();
-  bool earliestChanged = insert(timer);
+  bool earliestChanged = insert(index);
 
   if (earliestChanged) {
-    resetTimerfd(timerfd_, timer->expiration());
+    resetTimerfd(timerfd_, pool_.at(index)->expiration());
   }
 }
 
 void TimerQueue::cancelInLoop(TimerId timerId) {
   loop_->assertInLoopThread();
-  assert(timers_.size() == activeTimers_.size());
-  ActiveTimer timer(timerId.timer_, timerId.sequence_);
-  ActiveTimerSet::iterator it = activeTimers_.find(timer);
-  if (it != activeTimers_.end()) {
-    size_t n = timers_.erase(Entry(it->first->expiration(), it->first));
-    assert(n == 1); (void)n;
-    delete it->first; // FIXME: no delete please
-    activeTimers_.erase(it);
+  Timer* timer = pool_.get(timerId.index_, timerId.generation_);
+  if (timer == NULL) {
+    // Already gone.
+    return;
+  }
+
+  if (timers_.erase(Entry(timer->expiration(), timerId.index_)) == 1) {
+    pool_.release(timerId.index_);
   } else if (callingExpiredTimers_) {
-    cancelingTimers_.insert(timer);
+    // Expired, reset() drops it instead of restarting it.
+    cancelingTimers_.insert(timerId.index_);
   }
-  assert(timers_.size() == activeTimers_.size());
 }
 
 void TimerQueue::handleRead() {
@@ -135,7 +84,7 @@ void TimerQueue::handleRead() {
   // safe to callback outside critical section
   for (std::vector<Entry>::iterator it = expired.begin();
       it != expired.end(); ++it) {
-    it->second->run();
+    pool_.at(it->second)->run();
   }
   callingExpiredTimers_ = false;
 
@@ -143,22 +92,12 @@ void TimerQueue::handleRead() {
 }
 
 std::vector<TimerQueue::Entry> TimerQueue::getExpired(Timestamp now) {
-  assert(timers_.size() == activeTimers_.size());
   std::vector<Entry> expired;
-  Entry sentry(now, reinterpret_cast<Timer*>(UINTPTR_MAX));
+  Entry sentry(now, SlotPool<Timer>::kInvalidIndex);
   TimerList::iterator end = timers_.lower_bound(sentry);
   assert(end == timers_.end() || now < end->first);
   std::copy(timers_.begin(), end, back_inserter(expired));
   timers_.erase(timers_.begin(), end);
-
-  for (std::vector<Entry>::iterator it = expired.begin();
-      it != expired.end(); ++it) {
-    ActiveTimer timer(it->second, it->second->sequence());
-    size_t n = activeTimers_.erase(timer);
-    assert(n == 1); (void)n;
-  }
-
-  assert(timers_.size() == activeTimers_.size());
   return expired;
 }
 
@@ -167,19 +106,18 @@ void TimerQueue::reset(const std::vector<Entry>& expired, Timestamp now) {
 
   for (std::vector<Entry>::const_iterator it = expired.begin();
       it != expired.end(); ++it) {
-    ActiveTimer timer(it->second, it->second->sequence());
-    if (it->second->repeat()
-        && cancelingTimers_.find(timer) == cancelingTimers_.end()) {
-      it->second->restart(now);
+    Timer* timer = pool_.at(it->second);
+    if (timer->repeat()
+        && cancelingTimers_.find(it->second) == cancelingTimers_.end()) {
+      timer->restart(now);
       insert(it->second);
     } else {
-      // FIXME move to a free list
-      delete it->second; // FIXME: no delete please
+      pool_.release(it->second);
     }
   }
 
   if (!timers_.empty()) {
-    nextExpire = timers_.begin()->second->expiration();
+    nextExpire = timers_.begin()->first;
   }
 
   if (nextExpire.valid()) {
@@ -187,27 +125,19 @@ void TimerQueue::reset(const std::vector<Entry>& expired, Timestamp now) {
   }
 }
 
-bool TimerQueue::insert(Timer* timer) {
+bool TimerQueue::insert(uint32 index) {
   loop_->assertInLoopThread();
-  assert(timers_.size() == activeTimers_.size());
   bool earliestChanged = false;
-  Timestamp when = timer->expiration();
+  Timestamp when = pool_.at(index)->expiration();
   TimerList::iterator it = timers_.begin();
   if (it == timers_.end() || when < it->first) {
     earliestChanged = true;
   }
   {
     std::pair<TimerList::iterator, bool> result
-      = timers_.insert(Entry(when, timer));
+      = timers_.insert(Entry(when, index));
     assert(result.second); (void)result;
   }
-  {
-    std::pair<ActiveTimerSet::iterator, bool> result
-      = activeTimers_.insert(ActiveTimer(timer, timer->sequence()));
-    assert(result.second); (void)result;
-  }
-
-  assert(timers_.size() == activeTimers_.size());
   return earliestChanged;
 }
 
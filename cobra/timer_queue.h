@@ -4,15 +4,17 @@
 #include <set>
 #include <vector>
 
+#include "base/basic_types.h"
 #include "base/macros.h"
 #include "base/timestamp.h"
 #include "cobra/callbacks.h"
 #include "cobra/channel.h"
+#include "cobra/slot_pool.h"
+#include "cobra/timer.h"
 
 namespace cobra {
 
 class Worker;
-class Timer;
 class TimerId;
 
 // A best efforts timer queue.
@@ -33,13 +35,12 @@ class TimerQueue {
 
  private:
 
-  // FIXME use unique_ptr<Timer> instead of raw pointers.
-  typedef std::pair<Timestamp, Timer*> Entry;
+  // Timers are referred to by their slot in 'pool_'.
+  typedef std::pair<Timestamp, uint32> Entry;
   typedef std::set<Entry> TimerList;
-  typedef std::pair<Timer*, int64_t> ActiveTimer;
-  typedef std::set<ActiveTimer> ActiveTimerSet;
+  typedef std::set<uint32> TimerIndexSet;
 
-  void addTimerInLoop(Timer* timer);
+  void addTimerInLoop(uint32 index);
   void cancelInLoop(TimerId timerId);
 
   // called when timerfd alarms
@@ -49,18 +50,18 @@ class TimerQueue {
   std::vector<Entry> getExpired(Timestamp now);
   void reset(const std::vector<Entry>& expired, Timestamp now);
 
-  bool insert(Timer* timer);
+  bool insert(uint32 index);
 
   Worker* loop_;
   const int timerfd_;
   Channel timerfdChannel_;
+  SlotPool<Timer> pool_;
   // Timer list sorted by expiration
   TimerList timers_;
 
   // For cancel()
-  ActiveTimerSet activeTimers_;
   bool callingExpiredTimers_; /* atomic */
-  ActiveTimerSet cancelingTimers_;
+  TimerIndexSet cancelingTimers_;
 
   DISABLE_COPY_AND_ASSIGN(TimerQueue);
 };
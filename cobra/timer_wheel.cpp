@@ -0,0 +1,307 @@
+#include "cobra/timer_wheel.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+#include "base/Logging.h"
+#include "cobra/worker.h"
+#include "cobra/timer_id.h"
+#include "cobra/timerfd.h"
+
+namespace cobra {
+
+const int TimerWheel::kNumLevels;
+const int TimerWheel::kRootBits;
+const int TimerWheel::kLevelBits;
+const int TimerWheel::kRootSize;
+const int TimerWheel::kLevelSize;
+const int64_t TimerWheel::kTickMicroSeconds;
+const int64_t TimerWheel::kRootMask;
+const int64_t TimerWheel::kLevelMask;
+const int64_t TimerWheel::kMaxDelta;
+
+// The bit position of the slot index of 'level'.
+int TimerWheel::shiftOf(int level) {
+  return level == 0 ? 0 : kRootBits + (level - 1) * kLevelBits;
+}
+
+TimerWheel::TimerWheel(Worker* loop)
+  : loop_(loop),
+    timerfd_(createTimerfd()),
+    timerfdChannel_(loop, timerfd_),
+    currentTick_(Timestamp::now().microSecondsSinceEpoch() /
+                 kTickMicroSeconds),
+    armedTick_(-1),
+    rootCount_(0),
+    count_(0) {
+  std::fill(root_, root_ + kRootSize, static_cast<Entry*>(NULL));
+  for (int i = 0; i < kNumLevels - 1; ++i) {
+    std::fill(levels_[i], levels_[i] + kLevelSize, static_cast<Entry*>(NULL));
+  }
+
+  timerfdChannel_.SetReadCb(
+      boost::bind(&TimerWheel::handleRead, this));
+  // we are always reading the timerfd, we disarm it with timerfd_settime.
+  timerfdChannel_.enableReading();
+}
+
+TimerWheel::~TimerWheel() {
+  ::close(timerfd_);
+  // do not remove channel, since we're in Worker::dtor();
+  for (int i = 0; i < kRootSize; ++i) {
+    releaseAll(root_[i]);
+  }
+  for (int level = 0; level < kNumLevels - 1; ++level) {
+    for (int i = 0; i < kLevelSize; ++i) {
+      releaseAll(levels_[level][i]);
+    }
+  }
+}
+
+void TimerWheel::releaseAll(Entry* head) {
+  while (head) {
+    Entry* next = head->next;
+    pool_.release(head->index);
+    head = next;
+  }
+}
+
+TimerId TimerWheel::addTimer(const TimerCb& cb,
+                             Timestamp when,
+                             double interval) {
+  uint32 generation = 0;
+  uint32 index = pool_.acquire(&generation);
+  new (pool_.storage(index)) Entry(cb, when, interval, index);
+  loop_->runInLoop(
+      boost::bind(&TimerWheel::addTimerInLoop, this, index));
+  return TimerId(index, generation);
+}
+
+void TimerWheel::cancel(TimerId timerId) {
+  loop_->runInLoop(
+      boost::bind(&TimerWheel::cancelInLoop, this, timerId));
+}
+
+int64_t TimerWheel::toTick(Timestamp when) {
+  // Round up, a timer never fires before its time.
+  return (when.microSecondsSinceEpoch() + kTickMicroSeconds - 1) /
+         kTickMicroSeconds;
+}
+
+Timestamp TimerWheel::fromTick(int64_t tick) {
+  return Timestamp(tick * kTickMicroSeconds);
+}
+
+void TimerWheel::addTimerInLoop(uint32 index) {
+  loop_->assertInLoopThread();
+  Entry* entry = pool_.at(index);
+  entry->tick = toTick(entry->timer.expiration());
+  link(entry);
+
+  if (armedTick_ < 0 || entry->tick < armedTick_) {
+    arm(std::max(entry->tick, currentTick_));
+  }
+}
+
+void TimerWheel::cancelInLoop(TimerId timerId) {
+  loop_->assertInLoopThread();
+  Entry* entry = pool_.get(timerId.index_, timerId.generation_);
+  if (entry == NULL) {
+    // Already gone.
+    return;
+  }
+
+  if (entry->pprev) {
+    unlink(entry);
+    pool_.release(entry->index);
+  } else {
+    // Expired and about to run (or running), handleRead drops it.
+    entry->canceled = true;
+  }
+}
+
+void TimerWheel::handleRead() {
+  loop_->assertInLoopThread();
+  Timestamp now(Timestamp::now());
+  readTimerfd(timerfd_, now);
+  armedTick_ = -1;
+
+  advance(now.microSecondsSinceEpoch() / kTickMicroSeconds);
+
+  for (std::vector<Entry*>::iterator it = expired_.begin();
+      it != expired_.end(); ++it) {
+    if (!(*it)->canceled) {
+      (*it)->timer.run();
+    }
+  }
+
+  for (std::vector<Entry*>::iterator it = expired_.begin();
+      it != expired_.end(); ++it) {
+    Entry* entry = *it;
+    if (entry->timer.repeat() && !entry->canceled) {
+      entry->timer.restart(now);
+      entry->tick = toTick(entry->timer.expiration());
+      link(entry);
+    } else {
+      pool_.release(entry->index);
+    }
+  }
+  expired_.clear();
+
+  int64_t next = nextEventTick();
+  if (next >= 0 && (armedTick_ < 0 || next < armedTick_)) {
+    arm(next);
+  }
+}
+
+TimerWheel::Entry** TimerWheel::slotOf(int level, int64_t tick) {
+  if (level == 0) {
+    return &root_[tick & kRootMask];
+  }
+  return &levels_[level - 1][(tick >> shiftOf(level)) & kLevelMask];
+}
+
+void TimerWheel::link(Entry* entry) {
+  assert(entry->pprev == NULL);
+  int64_t delta = entry->tick - currentTick_;
+  int64_t tick = entry->tick;
+  if (delta < 0) {
+    // Already due, fire on the next tick processed.
+    delta = 0;
+    tick = currentTick_;
+  } else if (delta > kMaxDelta) {
+    delta = kMaxDelta;
+    tick = currentTick_ + kMaxDelta;
+  }
+
+  int level = 0;
+  while (level < kNumLevels - 1 && delta >> shiftOf(level + 1) != 0) {
+    ++level;
+  }
+
+  Entry** slot = slotOf(level, tick);
+  entry->next = *slot;
+  if (entry->next) {
+    entry->next->pprev = &entry->next;
+  }
+  *slot = entry;
+  entry->pprev = slot;
+  entry->inRoot = level == 0;
+
+  ++count_;
+  if (entry->inRoot) {
+    ++rootCount_;
+  }
+}
+
+void TimerWheel::unlink(Entry* entry) {
+  assert(entry->pprev != NULL);
+  *entry->pprev = entry->next;
+  if (entry->next) {
+    entry->next->pprev = entry->pprev;
+  }
+  entry->next = NULL;
+  entry->pprev = NULL;
+
+  --count_;
+  if (entry->inRoot) {
+    --rootCount_;
+  }
+}
+
+void TimerWheel::advance(int64_t nowTick) {
+  while (currentTick_ <= nowTick) {
+    if ((currentTick_ & kRootMask) == 0) {
+      for (int level = 1; level < kNumLevels; ++level) {
+        cascade(level);
+        if (((currentTick_ >> shiftOf(level)) & kLevelMask) != 0) {
+          break;
+        }
+      }
+    } else if (rootCount_ == 0) {
+      // Nothing before the next cascade, jump there.
+      int64_t next = (currentTick_ | kRootMask) + 1;
+      if (next > nowTick) {
+        currentTick_ = nowTick + 1;
+        break;
+      }
+      currentTick_ = next;
+      continue;
+    }
+
+    size_t before = expired_.size();
+    moveSlot(&root_[currentTick_ & kRootMask], &expired_);
+    rootCount_ -= expired_.size() - before;
+    ++currentTick_;
+  }
+}
+
+void TimerWheel::cascade(int level) {
+  cascading_.clear();
+  moveSlot(slotOf(level, currentTick_), &cascading_);
+  for (std::vector<Entry*>::iterator it = cascading_.begin();
+      it != cascading_.end(); ++it) {
+    link(*it);
+  }
+  cascading_.clear();
+}
+
+void TimerWheel::moveSlot(Entry** slot, std::vector<Entry*>* out) {
+  Entry* entry = *slot;
+  *slot = NULL;
+  while (entry) {
+    Entry* next = entry->next;
+    entry->next = NULL;
+    entry->pprev = NULL;
+    out->push_back(entry);
+    --count_;
+    entry = next;
+  }
+}
+
+int64_t TimerWheel::nextEventTick() const {
+  if (count_ == 0) {
+    return -1;
+  }
+
+  int64_t next = -1;
+  if (rootCount_ > 0) {
+    // Everything in the root is due within kRootSize ticks.
+    for (int64_t tick = currentTick_; ; ++tick) {
+      if (root_[tick & kRootMask]) {
+        next = tick;
+        break;
+      }
+    }
+  }
+
+  // Or the first non empty slot cascading before that.
+  for (int level = 1; level < kNumLevels; ++level) {
+    int64_t base = currentTick_ >> shiftOf(level);
+    // The current slot is still to be cascaded if we stand right on
+    // its boundary, otherwise it's the one of the next round.
+    bool onBoundary = (currentTick_ & ((1LL << shiftOf(level)) - 1)) == 0;
+    int64_t first = onBoundary ? 0 : 1;
+    for (int64_t d = first; d < first + kLevelSize; ++d) {
+      if (levels_[level - 1][(base + d) & kLevelMask]) {
+        int64_t tick = (base + d) << shiftOf(level);
+        if (next < 0 || tick < next) {
+          next = tick;
+        }
+        break;
+      }
+    }
+  }
+
+  return next;
+}
+
+void TimerWheel::arm(int64_t tick) {
+  armedTick_ = tick;
+  resetTimerfd(timerfd_, fromTick(tick));
+}
+
+}  // namespace cobra
@@ -0,0 +1,139 @@
+// Author: Jianbo Zhu
+//
+// A hashed hierarchical timing wheel.
+
+#ifndef COBRA_TIMERWHEEL_H_
+#define COBRA_TIMERWHEEL_H_
+
+#include <vector>
+
+#include "base/basic_types.h"
+#include "base/macros.h"
+#include "base/timestamp.h"
+#include "cobra/callbacks.h"
+#include "cobra/channel.h"
+#include "cobra/slot_pool.h"
+#include "cobra/timer.h"
+
+namespace cobra {
+
+class Worker;
+class TimerId;
+
+// Drop-in alternative to TimerQueue for loops with lots of timers,
+// eg. one idle timeout per connection.
+//
+// Timers are hashed by their expiration tick (1ms) into 4 levels of
+// slots (256, 64, 64, 64 slots, ~18.6 hours in total), and cascaded
+// down a level when the lower one wraps. Insert and cancel are O(1),
+// and the timerfd is only re-armed when a timer is added before the
+// currently armed expiration. Entries live in a pool, so once warmed up
+// adding and canceling timers allocates nothing.
+class TimerWheel {
+ public:
+  TimerWheel(Worker* loop);
+  ~TimerWheel();
+
+  // Schedules the callback to be run at given time,
+  // repeats if @c interval > 0.0.
+  //
+  // Must be thread safe. Usually be called from other threads.
+  TimerId addTimer(const TimerCb& cb,
+                   Timestamp when,
+                   double interval);
+
+  void cancel(TimerId timerId);
+
+ private:
+  static const int kNumLevels = 4;
+  static const int kRootBits = 8;
+  static const int kLevelBits = 6;
+  static const int kRootSize = 1 << kRootBits;
+  static const int kLevelSize = 1 << kLevelBits;
+  static const int64_t kRootMask = kRootSize - 1;
+  static const int64_t kLevelMask = kLevelSize - 1;
+  static const int64_t kTickMicroSeconds = 1000;
+  // Timers further away than this are parked in the last level
+  // and cascaded until they get close enough.
+  static const int64_t kMaxDelta =
+      (1LL << (kRootBits + (kNumLevels - 1) * kLevelBits)) - 1;
+
+  // A timer linked in a slot.
+  struct Entry {
+    Entry(const TimerCb& cb, Timestamp when, double interval, uint32 index)
+      : timer(cb, when, interval),
+        index(index),
+        next(NULL),
+        pprev(NULL),
+        tick(0),
+        inRoot(false),
+        canceled(false) {
+    }
+
+    Timer timer;
+    // Our slot in 'pool_'.
+    const uint32 index;
+    Entry* next;
+    // Points to the previous 'next', NULL if not in a slot.
+    Entry** pprev;
+    int64_t tick;
+    // Linked in a slot of 'root_'.
+    bool inRoot;
+    // Canceled while expired, don't run nor restart it.
+    bool canceled;
+  };
+
+  static int shiftOf(int level);
+  static int64_t toTick(Timestamp when);
+  static Timestamp fromTick(int64_t tick);
+
+  void addTimerInLoop(uint32 index);
+  void cancelInLoop(TimerId timerId);
+
+  // called when timerfd alarms
+  void handleRead();
+
+  // Drops all the entries of a slot list, for dtor.
+  void releaseAll(Entry* head);
+
+  // Links 'entry' in the slot matching its tick.
+  void link(Entry* entry);
+  void unlink(Entry* entry);
+
+  // Processes all ticks up to 'nowTick', moving the due timers
+  // to 'expired_'.
+  void advance(int64_t nowTick);
+  void cascade(int level);
+  void moveSlot(Entry** slot, std::vector<Entry*>* out);
+
+  // The first tick something may happen at, -1 if empty.
+  int64_t nextEventTick() const;
+  void arm(int64_t tick);
+
+  Entry** slotOf(int level, int64_t tick);
+
+  Worker* loop_;
+  const int timerfd_;
+  Channel timerfdChannel_;
+
+  // The next tick to be processed.
+  int64_t currentTick_;
+  // The tick the timerfd is armed for, -1 if disarmed.
+  int64_t armedTick_;
+
+  Entry* root_[kRootSize];
+  Entry* levels_[kNumLevels - 1][kLevelSize];
+  // Number of entries linked in 'root_' and in the whole wheel.
+  size_t rootCount_;
+  size_t count_;
+
+  SlotPool<Entry> pool_;
+  std::vector<Entry*> expired_;
+  std::vector<Entry*> cascading_;
+
+  DISABLE_COPY_AND_ASSIGN(TimerWheel);
+};
+
+}  // namespace cobra
+
+#endif  // COBRA_TIMERWHEEL_H_
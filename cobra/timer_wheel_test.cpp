@@ -0,0 +1,183 @@
+// Author: Jianbo Zhu
+//
+// TimerWheel, through the timers of a Worker: expiries on both sides of
+// the level boundaries, timers canceled before they are linked, and
+// repeating timers cascaded down on every round.
+
+#include "cobra/timer_wheel.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <gtest/gtest.h>
+
+#include "base/CountDownLatch.h"
+#include "base/timestamp.h"
+#include "cobra/timer_id.h"
+#include "cobra/worker.h"
+
+namespace cobra {
+namespace {
+
+// 1ms ticks, 256 root slots, 64 slots a level, as in TimerWheel.
+const int64_t kTickMicroSeconds = 1000;
+const int64_t kRootSize = 256;
+const int64_t kLevelSize = 64;
+// How late a timer may run on a loaded box.
+const double kSlackSeconds = 0.2;
+
+// Where the wheel stands for a timer added now, at a tick boundary.
+Timestamp tickFloor(Timestamp when) {
+  return Timestamp(when.microSecondsSinceEpoch() / kTickMicroSeconds *
+                   kTickMicroSeconds);
+}
+
+Timestamp afterTicks(Timestamp base, int64_t ticks) {
+  return Timestamp(base.microSecondsSinceEpoch() + ticks * kTickMicroSeconds);
+}
+
+void record(Timestamp* fired) {
+  *fired = Timestamp::now();
+}
+
+void count(std::vector<Timestamp>* runs) {
+  runs->push_back(Timestamp::now());
+}
+
+void setFlag(bool* flag) {
+  *flag = true;
+}
+
+TEST(TimerWheelTest, ExpiresAtLevelBoundaries) {
+  Worker loop(Worker::kTimerWheel);
+  const Timestamp base = tickFloor(Timestamp::now());
+  // Each side of the root (256 ticks) and of the first level
+  // (256 * 64 ticks), the wheel may stand one tick behind 'base'.
+  const int64_t ticks[] = {
+    1,
+    kRootSize - 2, kRootSize - 1, kRootSize, kRootSize + 1,
+    kRootSize * 2 - 1, kRootSize * 2,
+    kRootSize * kLevelSize - 1, kRootSize * kLevelSize,
+    kRootSize * kLevelSize + 1,
+  };
+  const int n = sizeof ticks / sizeof ticks[0];
+
+  std::vector<Timestamp> fired(n);
+  for (int i = 0; i < n; ++i) {
+    loop.runAt(afterTicks(base, ticks[i]), boost::bind(&record, &fired[i]));
+  }
+  loop.runAt(afterTicks(base, ticks[n - 1] + 100),
+             boost::bind(&Worker::Quit, &loop));
+  loop.Loop();
+
+  for (int i = 0; i < n; ++i) {
+    const Timestamp when = afterTicks(base, ticks[i]);
+    ASSERT_TRUE(fired[i].valid()) << ticks[i] << " ticks";
+    // Never early, at most a little late.
+    EXPECT_GE(fired[i].microSecondsSinceEpoch(), when.microSecondsSinceEpoch())
+        << ticks[i] << " ticks";
+    EXPECT_LT(timeDifference(fired[i], when), kSlackSeconds)
+        << ticks[i] << " ticks";
+  }
+}
+
+// Holds the loop in a functor, so what other threads queue meanwhile
+// runs in one go once released.
+void block(CountDownLatch* blocked, CountDownLatch* release) {
+  blocked->countDown();
+  release->wait();
+}
+
+struct Fired {
+  Fired() : soon(false), past(false), far(false), kept(false) {}
+
+  bool soon;
+  bool past;
+  bool far;
+  bool kept;
+};
+
+// Adds timers and cancels them from another thread while the loop is
+// blocked, their addTimerInLoop still to run when cancel is called.
+void addAndCancel(Worker* loop,
+                  Fired* fired,
+                  CountDownLatch* blocked,
+                  CountDownLatch* release) {
+  blocked->wait();
+  const Timestamp now = Timestamp::now();
+  loop->cancel(loop->runAt(addTime(now, 0.01),
+                           boost::bind(&setFlag, &fired->soon)));
+  // Already due when linked.
+  loop->cancel(loop->runAt(addTime(now, -1.0),
+                           boost::bind(&setFlag, &fired->past)));
+  // Linked in a level, not in the root.
+  loop->cancel(loop->runAt(addTime(now, 0.3),
+                           boost::bind(&setFlag, &fired->far)));
+  loop->runAt(addTime(now, 0.05), boost::bind(&setFlag, &fired->kept));
+  release->countDown();
+}
+
+TEST(TimerWheelTest, CancelBeforeAddTimerInLoop) {
+  Worker loop(Worker::kTimerWheel);
+  CountDownLatch blocked(1);
+  CountDownLatch release(1);
+  Fired fired;
+
+  loop.runAfter(0.001, boost::bind(&block, &blocked, &release));
+  loop.runAfter(0.5, boost::bind(&Worker::Quit, &loop));
+  boost::thread other(
+      boost::bind(&addAndCancel, &loop, &fired, &blocked, &release));
+  loop.Loop();
+  other.join();
+
+  EXPECT_FALSE(fired.soon);
+  EXPECT_FALSE(fired.past);
+  EXPECT_FALSE(fired.far);
+  EXPECT_TRUE(fired.kept);
+}
+
+TEST(TimerWheelTest, RepeatsAcrossCascades) {
+  Worker loop(Worker::kTimerWheel);
+  // 100 ticks stays in the root but crosses its wrap every few rounds,
+  // 300 ticks is linked in the first level and cascaded every round.
+  std::vector<Timestamp> shortRuns;
+  std::vector<Timestamp> longRuns;
+  const Timestamp start = Timestamp::now();
+  loop.runEvery(0.1, boost::bind(&count, &shortRuns));
+  loop.runEvery(0.3, boost::bind(&count, &longRuns));
+  loop.runAfter(1.55, boost::bind(&Worker::Quit, &loop));
+  loop.Loop();
+
+  ASSERT_GE(shortRuns.size(), 13u);
+  EXPECT_LE(shortRuns.size(), 15u);
+  ASSERT_GE(longRuns.size(), 4u);
+  EXPECT_LE(longRuns.size(), 5u);
+
+  // Each run is an interval after the previous one, never early.
+  Timestamp previous = start;
+  for (size_t i = 0; i < shortRuns.size(); ++i) {
+    EXPECT_GE(timeDifference(shortRuns[i], previous), 0.1 - 0.001) << i;
+    previous = shortRuns[i];
+  }
+  previous = start;
+  for (size_t i = 0; i < longRuns.size(); ++i) {
+    EXPECT_GE(timeDifference(longRuns[i], previous), 0.3 - 0.001) << i;
+    previous = longRuns[i];
+  }
+}
+
+TEST(TimerWheelTest, CancelRepeating) {
+  Worker loop(Worker::kTimerWheel);
+  std::vector<Timestamp> runs;
+  const TimerId id = loop.runEvery(0.05, boost::bind(&count, &runs));
+  // Canceled between its 3rd and 4th run.
+  loop.runAfter(0.155, boost::bind(&Worker::cancel, &loop, id));
+  loop.runAfter(0.4, boost::bind(&Worker::Quit, &loop));
+  loop.Loop();
+
+  EXPECT_EQ(3u, runs.size());
+}
+
+}  // Anonymous namespace
+}  // namespace cobra
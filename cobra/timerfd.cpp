@@ -0,0 +1,63 @@
+#include "cobra/timerfd.h"
+
+#include <strings.h>  // bzero
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "base/Logging.h"
+
+namespace cobra {
+
+namespace {
+
+timespec howMuchTimeFromNow(Timestamp when) {
+  int64_t microseconds = when.microSecondsSinceEpoch()
+                         - Timestamp::now().microSecondsSinceEpoch();
+  if (microseconds < 100) {
+    microseconds = 100;
+  }
+
+  timespec ts;
+  ts.tv_sec = static_cast<time_t>(
+      microseconds / Timestamp::kMicroSecondsPerSecond);
+  ts.tv_nsec = static_cast<long>(
+      (microseconds % Timestamp::kMicroSecondsPerSecond) * 1000);
+
+  return ts;
+}
+
+}  // Anonymous namespace
+
+int createTimerfd() {
+  int timerfd = ::timerfd_create(CLOCK_MONOTONIC,
+                                 TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timerfd < 0) {
+    LOG_SYSFATAL << "Failed in timerfd_create";
+  }
+
+  return timerfd;
+}
+
+void readTimerfd(int timerfd, Timestamp now) {
+  uint64_t howmany;
+  ssize_t n = ::read(timerfd, &howmany, sizeof howmany);
+  LOG_TRACE << "readTimerfd() " << howmany << " at " << now.toString();
+  if (n != sizeof howmany) {
+    LOG_ERROR << "readTimerfd() reads " << n << " bytes instead of 8";
+  }
+}
+
+void resetTimerfd(int timerfd, Timestamp expiration) {
+  // wake up loop by timerfd_settime()
+   itimerspec newValue;
+   itimerspec oldValue;
+  bzero(&newValue, sizeof newValue);
+  bzero(&oldValue, sizeof oldValue);
+  newValue.it_value = howMuchTimeFromNow(expiration);
+  int ret = ::timerfd_settime(timerfd, 0, &newValue, &oldValue);
+  if (ret) {
+    LOG_SYSERR << "timerfd_settime()";
+  }
+}
+
+}  // namespace cobra
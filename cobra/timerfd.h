@@ -0,0 +1,23 @@
+// Author: Jianbo Zhu
+//
+// Helpers around timerfd(2), shared by the timer implementations.
+
+#ifndef COBRA_TIMERFD_H_
+#define COBRA_TIMERFD_H_
+
+#include "base/timestamp.h"
+
+namespace cobra {
+
+// A non-blocking, close-on-exec CLOCK_MONOTONIC timerfd. Aborts on failure.
+int createTimerfd();
+
+// Consumes the expiration count, so the fd is not readable any more.
+void readTimerfd(int timerfd, Timestamp now);
+
+// Arms the timerfd to expire once at 'expiration'.
+void resetTimerfd(int timerfd, Timestamp expiration);
+
+}  // namespace cobra
+
+#endif  // COBRA_TIMERFD_H_
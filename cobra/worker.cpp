@@ -5,11 +5,15 @@
 
 #include <boost/bind.hpp>
 
+#include "base/CurrentThread.h"
 #include "base/Logging.h"
 #include "cobra/channel.h"
+#include "cobra/connection_pool.h"
 #include "cobra/poller.h"
 #include "cobra/socket_wrapper.h"
 #include "cobra/timer_queue.h"
+#include "cobra/timer_wheel.h"
+#include "cobra/zero_copy_linger.h"
 
 namespace cobra {
 
@@ -46,14 +50,16 @@ Worker* Worker::getWorkerOfCurrentThread() {
   return t_loopInThisThread;
 }
 
-Worker::Worker()
+Worker::Worker(TimerType timerType)
   : looping_(false),
     quit_(false),
     threadId_(boost::this_thread::get_id()),
-    timerQueue_(new TimerQueue(this)),
     poller_(Poller::newDefaultPoller(this)), // TODO(zhujianbo): Don't call this in ctor.
     wakeupFd_(createEventfd()),
     wakeupChannel_(new Channel(this, wakeupFd_)),
+    wakeupPending_(0),
+    connectionPool_(new ConnectionPool),
+    zeroCopyLinger_(new ZeroCopyLinger(this)),
     eventHandling_(false),
     currentActiveChannel_(NULL),
     callingPendingFunctors_(false) {
@@ -65,6 +71,12 @@ Worker::Worker()
     t_loopInThisThread = this;
   }
 
+  if (timerType == kTimerWheel) {
+    timerWheel_.reset(new TimerWheel(this));
+  } else {
+    timerQueue_.reset(new TimerQueue(this));
+  }
+
   wakeupChannel_->SetReadCb(
       boost::bind(&Worker::handleRead, this));
 
@@ -76,6 +88,9 @@ Worker::~Worker() {
   //LOG_DEBUG << "Worker " << this << " of thread " << threadId_
   //          << " des in thread " << boost::this_thread::get_id();
   ::close(wakeupFd_);
+  // Connections still held by users give their storage back to the
+  // system from now on.
+  connectionPool_->close();
   t_loopInThisThread = NULL;
 }
 
@@ -104,6 +119,7 @@ void Worker::Loop() {
     eventHandling_ = false;
 
     doPendingFunctors();
+    doBeforePollFunctors();
   }
 
   LOG_TRACE << "Worker " << this << " stop looping";
@@ -129,17 +145,22 @@ void Worker::runInLoop(const Functor& cb) {
 }
 
 void Worker::queueInLoop(const Functor& cb) {
-  {
-    boost::mutex::scoped_lock lock(mutex_);
-    pendingFunctors_.push_back(cb);
-  }
+  pendingFunctors_.push(cb);
 
   if (!isInLoopThread() || callingPendingFunctors_) {
     wakeup();
   }
 }
 
+void Worker::runBeforePoll(const Functor& cb) {
+  assertInLoopThread();
+  beforePollFunctors_.push_back(cb);
+}
+
 TimerId Worker::runAt(const Timestamp& time, const TimerCb& cb) {
+  if (timerWheel_) {
+    return timerWheel_->addTimer(cb, time, 0.0);
+  }
   return timerQueue_->addTimer(cb, time, 0.0);
 }
 
@@ -150,10 +171,16 @@ TimerId Worker::runAfter(double delay, const TimerCb& cb) {
 
 TimerId Worker::runEvery(double interval, const TimerCb& cb) {
   Timestamp time(addTime(Timestamp::now(), interval));
+  if (timerWheel_) {
+    return timerWheel_->addTimer(cb, time, interval);
+  }
   return timerQueue_->addTimer(cb, time, interval);
 }
 
 void Worker::cancel(TimerId timerId) {
+  if (timerWheel_) {
+    return timerWheel_->cancel(timerId);
+  }
   return timerQueue_->cancel(timerId);
 }
 
@@ -175,6 +202,20 @@ void Worker::removeChannel(Channel* channel) {
   poller_->removeChannel(channel);
 }
 
+bool Worker::completionIo() const {
+  return poller_->completionIo();
+}
+
+void Worker::submitSend(Channel* channel,
+                        const struct iovec* iov,
+                        int iovcnt,
+                        const boost::shared_ptr<void>& owner) {
+  assert(channel->ownerLoop() == this);
+  assertInLoopThread();
+
+  poller_->submitSend(channel, iov, iovcnt, owner);
+}
+
 void Worker::abortNotInLoopThread() {
   //LOG_FATAL << "Worker::abortNotInLoopThread - Worker " << this
             //<< " was created in threadId_ = " << threadId_
@@ -182,6 +223,17 @@ void Worker::abortNotInLoopThread() {
 }
 
 void Worker::wakeup() {
+  // Someone has already written the eventfd and the loop has not started
+  // draining yet, it will see our functor too.
+  if (!__sync_bool_compare_and_swap(&wakeupPending_, 0, 1)) {
+    if (!isInLoopThread()) {
+      const int shard = CurrentThread::tid() % kWakeupShards;
+      wakeupsSaved_[shard].saved.increment();
+    }
+    return;
+  }
+
+  wakeupWrites_.increment();
   uint64_t one = 1;
   ssize_t n = write(wakeupFd_, &one, sizeof one);
   if (n != sizeof one) {
@@ -189,6 +241,14 @@ void Worker::wakeup() {
   }
 }
 
+int64_t Worker::wakeupsSaved() {
+  int64_t saved = 0;
+  for (int i = 0; i < kWakeupShards; ++i) {
+    saved += wakeupsSaved_[i].saved.get();
+  }
+  return saved;
+}
+
 void Worker::handleRead() {
   uint64_t one = 1;
   ssize_t n = read(wakeupFd_, &one, sizeof one);
@@ -198,20 +258,48 @@ void Worker::handleRead() {
 }
 
 void Worker::doPendingFunctors() {
-  std::vector<Functor> functors;
   callingPendingFunctors_ = true;
 
-  {
-    boost::mutex::scoped_lock lock(mutex_);
-    functors.swap(pendingFunctors_);
+  // Re-arm the wakeup before taking out the functors. A producer that
+  // pushes after this point writes the eventfd again, one that pushed
+  // before is drained below. Both are full barriers.
+  __sync_val_compare_and_swap(&wakeupPending_, 1, 0);
+
+  // Take out what is queued now, functors queued by the ones we run
+  // are left for the next iteration (the loop is woken up for them).
+  Functor functor;
+  while (pendingFunctors_.pop(&functor)) {
+    runningFunctors_.push_back(Functor());
+    runningFunctors_.back().swap(functor);
   }
 
-  std::vector<Functor>::const_iterator iter = functors.begin();
-  for (; iter != functors.end(); ++iter) {
+  std::vector<Functor>::iterator iter = runningFunctors_.begin();
+  for (; iter != runningFunctors_.end(); ++iter) {
     (*iter)();
   }
+  runningFunctors_.clear();
 
   callingPendingFunctors_ = false;
 }
 
+void Worker::doBeforePollFunctors() {
+  if (beforePollFunctors_.empty()) {
+    return;
+  }
+
+  // Functors queued by the ones we run are for the next iteration.
+  runningBeforePollFunctors_.swap(beforePollFunctors_);
+  std::vector<Functor>::iterator iter = runningBeforePollFunctors_.begin();
+  for (; iter != runningBeforePollFunctors_.end(); ++iter) {
+    (*iter)();
+  }
+  runningBeforePollFunctors_.clear();
+
+  // Nobody wakes us up for what they queued in the loop thread,
+  // don't let it wait for the next event.
+  if (!pendingFunctors_.empty() || !beforePollFunctors_.empty()) {
+    wakeup();
+  }
+}
+
 }  // namespace cobra
@@ -11,19 +11,27 @@
 
 #include <boost/function.hpp>
 #include <boost/scoped_ptr.hpp>
-#include <boost/thread/mutex.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread/thread.hpp>
 
+#include "base/Atomic.h"
+#include "base/basic_types.h"
 #include "base/macros.h"
 #include "base/timestamp.h"
 #include "cobra/callbacks.h"
+#include "cobra/mpsc_queue.h"
 #include "cobra/timer_id.h"
 
+struct iovec;
+
 namespace cobra {
 
 class Channel;
+class ConnectionPool;
 class Poller;
 class TimerQueue;
+class TimerWheel;
+class ZeroCopyLinger;
 
 // The reactor.
 // Realized as one reactor per thread.
@@ -32,7 +40,15 @@ class Worker {
   // User callbacks.
   typedef boost::function<void()> Functor;
 
-  Worker();
+  // The timer implementation backing runAt/runAfter/runEvery.
+  enum TimerType {
+    // Ordered sets, @see TimerQueue.
+    kTimerQueue,
+    // O(1) insert and cancel, for lots of timers, @see TimerWheel.
+    kTimerWheel
+  };
+
+  explicit Worker(TimerType timerType = kTimerQueue);
   ~Worker();
 
   // Loops forever.
@@ -62,6 +78,14 @@ class Worker {
   // Safe to call from other threads.
   void queueInLoop(const Functor& cb);
 
+  // Runs callback at the end of the current iteration, once the events
+  // and the pending functors are handled, right before polling again.
+  // Used to batch work done by several handlers, @see
+  // TcpConnection::setAutoCork.
+  //
+  // Must be called in the loop thread.
+  void runBeforePoll(const Functor& cb);
+
   ////////////////////// begin /////////////////////////////////
   // timers
 
@@ -83,8 +107,36 @@ class Worker {
   ///////////////////////// end ///////////////////////////////
 
   // Only for internal usage
+  //
+  // Wakeups are coalesced: only the first call after the loop starts
+  // draining pending functors writes to the eventfd.
   void wakeup();
 
+  ////////////////////// begin /////////////////////////////////
+  // loop statistics, safe to read from other threads.
+
+  // Number of wakeups that did write the eventfd.
+  int64_t wakeupWrites() { return wakeupWrites_.get(); }
+
+  // Number of posts from other threads that found a wakeup pending and
+  // didn't write the eventfd, i.e. syscalls saved.
+  int64_t wakeupsSaved();
+  ///////////////////////// end ///////////////////////////////
+
+  ////////////////////// begin /////////////////////////////////
+  // load counters, kept by the connections of this loop and read by
+  // the dispatcher, @see WorkerThreadPool::DispatchPolicy.
+  // Thread safe.
+
+  // Number of connections served by this loop.
+  int32 connectionCount() { return connectionCount_.get(); }
+  void addConnectionCount(int32 delta) { connectionCount_.add(delta); }
+
+  // Bytes queued in the output buffers of these connections.
+  int64 pendingBytes() { return pendingBytes_.get(); }
+  void addPendingBytes(int64 delta) { pendingBytes_.add(delta); }
+  ///////////////////////// end ///////////////////////////////
+
   // Update the monitoring events(read/write/err ect) of an fd(the socket)
   // wrapped in a channel or adding a new fd to the system call 'poll'
   // to monitor.
@@ -94,6 +146,15 @@ class Worker {
   // Remove a fd, which is monotoring by the 'poll'.
   void removeChannel(Channel* channel);
 
+  // The poller receives and sends itself, @see Poller::completionIo.
+  bool completionIo() const;
+
+  // @see Poller::submitSend.
+  void submitSend(Channel* channel,
+                  const struct iovec* iov,
+                  int iovcnt,
+                  const boost::shared_ptr<void>& owner);
+
   // pid_t threadId() const { return threadId_; }
   void assertInLoopThread() {
     if (!isInLoopThread()) {
@@ -115,6 +176,18 @@ class Worker {
 
   static Worker* getWorkerOfCurrentThread();
 
+  // Storage recycled across the connections of this loop, held by them
+  // too, @see ConnectionPool.
+  // Thread safe.
+  const boost::shared_ptr<ConnectionPool>& connectionPool() {
+    return connectionPool_;
+  }
+
+  // Keeps the sockets of the connections destroyed with zerocopy sends
+  // in flight, @see ZeroCopyLinger.
+  // Thread safe.
+  ZeroCopyLinger* zeroCopyLinger() { return zeroCopyLinger_.get(); }
+
  private:
   void abortNotInLoopThread();
 
@@ -122,8 +195,11 @@ class Worker {
   bool quit_; /* atomic and shared between threads, okay on x86, I guess. */
   const boost::thread::id threadId_;
   Timestamp pollReturnTime_;
-  boost::scoped_ptr<TimerQueue> timerQueue_;
+  // Must be constructed before the timers, which register their timerfd.
   boost::scoped_ptr<Poller> poller_;
+  // Only one of them is used, according to the TimerType.
+  boost::scoped_ptr<TimerQueue> timerQueue_;
+  boost::scoped_ptr<TimerWheel> timerWheel_;
 
   // The eventfd wait/inotify mechanism.
   int wakeupFd_;
@@ -134,17 +210,42 @@ class Worker {
   // The registered callback function for 'eventfd'.
   void handleRead();  // waked up
 
+  // 1 if the eventfd has been written since the last drain of the
+  // pending functors, accessed with __sync builtins.
+  volatile int wakeupPending_;
+  AtomicInt64 wakeupWrites_;
+  // Counted by the producers, each on the shard of its thread, so that
+  // they don't bounce one cache line between them.
+  static const int kWakeupShards = 16;
+  struct WakeupShard {
+    AtomicInt64 saved;
+    char pad[64 - sizeof(AtomicInt64)];
+  };
+  WakeupShard wakeupsSaved_[kWakeupShards];
+  AtomicInt32 connectionCount_;
+  AtomicInt64 pendingBytes_;
+  boost::shared_ptr<ConnectionPool> connectionPool_;
+  boost::scoped_ptr<ZeroCopyLinger> zeroCopyLinger_;
+
   bool eventHandling_; /* atomic */
   typedef std::vector<Channel*> ChannelList;
   ChannelList activeChannels_;
   Channel* currentActiveChannel_;
 
-  boost::mutex mutex_;
   bool callingPendingFunctors_; /* atomic */
-  std::vector<Functor> pendingFunctors_; // @GuardedBy mutex_
+  // Pushed by any thread, drained only by the loop thread.
+  MpscQueue<Functor> pendingFunctors_;
+  // The functors taken out by one doPendingFunctors, reused across
+  // iterations to avoid reallocating.
+  std::vector<Functor> runningFunctors_;
   // Execute the pending functions in the pendingFunctors_.
   void doPendingFunctors();
 
+  // For runBeforePoll(), swapped out before running.
+  std::vector<Functor> beforePollFunctors_;
+  std::vector<Functor> runningBeforePollFunctors_;
+  void doBeforePollFunctors();
+
   DISABLE_COPY_AND_ASSIGN(Worker);
 };
 
@@ -9,8 +9,10 @@
 
 namespace cobra {
 
-WorkerThread::WorkerThread(const ThreadInitCb& cb)
+WorkerThread::WorkerThread(const ThreadInitCb& cb,
+                           Worker::TimerType timerType)
   : init_cb_(cb),
+    timer_type_(timerType),
     worker_(NULL),
     exiting_(false) {
 }
@@ -27,7 +29,8 @@ WorkerThread::~WorkerThread() {
 }
 
 Worker* WorkerThread::StartLoop() {
-  assert(!thread_.started());
+  // Not-a-thread until started.
+  assert(thread_.get_id() == boost::thread::id());
   thread_ = boost::thread(boost::bind(&WorkerThread::ThreadFunc, this));
 
   {
@@ -42,7 +45,7 @@ Worker* WorkerThread::StartLoop() {
 
 // Start an event loop in every thread from the thread pool.
 void WorkerThread::ThreadFunc() {
-  Worker worker;
+  Worker worker(timer_type_);
 
   if (init_cb_) {
     init_cb_(&worker);
@@ -12,16 +12,16 @@
 #include <boost/thread/thread.hpp>
 
 #include "base/macros.h"
+#include "cobra/worker.h"
 
 namespace cobra {
 
-class Worker;
-
 class WorkerThread {
  public:
   typedef boost::function<void(Worker*)> ThreadInitCb;
 
-  WorkerThread(const ThreadInitCb& cb = ThreadInitCb());
+  WorkerThread(const ThreadInitCb& cb = ThreadInitCb(),
+               Worker::TimerType timerType = Worker::kTimerQueue);
   ~WorkerThread();
 
   Worker* StartLoop();
@@ -29,6 +29,7 @@ class WorkerThread {
  private:
   void ThreadFunc();
   ThreadInitCb init_cb_;
+  Worker::TimerType timer_type_;
 
   Worker* worker_;
 
@@ -11,7 +11,10 @@ WorkerThreadPool::WorkerThreadPool(Worker* baseLoop)
   : baseLoop_(baseLoop),
     started_(false),
     numThreads_(0),
-    next_(0) {
+    timerType_(Worker::kTimerQueue),
+    next_(0),
+    policy_(kRoundRobin),
+    seed_(2463534242u) {
 }
 
 WorkerThreadPool::~WorkerThreadPool() {
@@ -25,7 +28,7 @@ void WorkerThreadPool::start(const ThreadInitCb& cb) {
 
   // Start event loop threads
   for (int i = 0; i < numThreads_; ++i) {
-    WorkerThread* t = new WorkerThread(cb);
+    WorkerThread* t = new WorkerThread(cb, timerType_);
     threads_.push_back(t);
     loops_.push_back(t->StartLoop());
   }
@@ -40,15 +43,95 @@ Worker* WorkerThreadPool::getNextLoop() {
   Worker* loop = baseLoop_;
 
   if (!loops_.empty()) {
-    // round-robin
-    loop = loops_[next_];
-    ++next_;
-    if (implicit_cast<size_t>(next_) >= loops_.size()) {
-      next_ = 0;
+    size_t index = 0;
+    switch (policy_) {
+      case kLeastConnections:
+        index = leastConnectionsIndex();
+        break;
+      case kLeastPendingBytes:
+        index = leastPendingBytesIndex();
+        break;
+      case kPowerOfTwoChoices:
+        index = powerOfTwoChoicesIndex();
+        break;
+      default:
+        index = nextIndex();
+        break;
     }
+    loop = loops_[index];
   }
 
   return loop;
 }
 
+size_t WorkerThreadPool::nextIndex() {
+  // round-robin
+  size_t index = next_;
+  ++next_;
+  if (implicit_cast<size_t>(next_) >= loops_.size()) {
+    next_ = 0;
+  }
+  return index;
+}
+
+size_t WorkerThreadPool::leastConnectionsIndex() {
+  // Scan from the round-robin position, so that ties are spread.
+  size_t best = nextIndex();
+  int32 bestCount = loops_[best]->connectionCount();
+  for (size_t i = 1; i < loops_.size() && bestCount > 0; ++i) {
+    size_t index = (best + i) % loops_.size();
+    int32 count = loops_[index]->connectionCount();
+    if (count < bestCount) {
+      best = index;
+      bestCount = count;
+    }
+  }
+  return best;
+}
+
+size_t WorkerThreadPool::leastPendingBytesIndex() {
+  size_t best = nextIndex();
+  int64 bestBytes = loops_[best]->pendingBytes();
+  for (size_t i = 1; i < loops_.size() && bestBytes > 0; ++i) {
+    size_t index = (best + i) % loops_.size();
+    int64 bytes = loops_[index]->pendingBytes();
+    if (bytes < bestBytes) {
+      best = index;
+      bestBytes = bytes;
+    }
+  }
+  return best;
+}
+
+size_t WorkerThreadPool::powerOfTwoChoicesIndex() {
+  const size_t n = loops_.size();
+  if (n == 1) {
+    return 0;
+  }
+  size_t a = random() % n;
+  // Another one, different from 'a'.
+  size_t b = (a + 1 + random() % (n - 1)) % n;
+  int32 countA = loops_[a]->connectionCount();
+  int32 countB = loops_[b]->connectionCount();
+  if (countA != countB) {
+    return countA < countB ? a : b;
+  }
+  return loops_[a]->pendingBytes() <= loops_[b]->pendingBytes() ? a : b;
+}
+
+uint32 WorkerThreadPool::random() {
+  seed_ ^= seed_ << 13;
+  seed_ ^= seed_ >> 17;
+  seed_ ^= seed_ << 5;
+  return seed_;
+}
+
+std::vector<Worker*> WorkerThreadPool::getAllLoops() {
+  assert(started_);
+  if (loops_.empty()) {
+    return std::vector<Worker*>(1, baseLoop_);
+  }
+  return loops_;
+}
+
 }  // namespace cobra
@@ -6,29 +6,64 @@
 #include <boost/function.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
 
+#include "base/basic_types.h"
 #include "base/macros.h"
+#include "cobra/worker.h"
 
 namespace cobra {
 
-class Worker;
 class WorkerThread;
 
 class WorkerThreadPool {
  public:
   typedef boost::function<void(Worker*)> ThreadInitCb;
 
+  // How getNextLoop picks the loop of a new connection, from the load
+  // counters of the loops, @see Worker::connectionCount.
+  enum DispatchPolicy {
+    // Each loop in turn.
+    kRoundRobin,
+    // The loop with the fewest connections.
+    kLeastConnections,
+    // The loop with the fewest bytes waiting to be sent.
+    kLeastPendingBytes,
+    // The less loaded (fewer connections) of two loops drawn at random,
+    // nearly as even as kLeastConnections without scanning every loop,
+    // and no herding on a stale minimum.
+    kPowerOfTwoChoices
+  };
+
   WorkerThreadPool(Worker* baseLoop);
   ~WorkerThreadPool();
 
   void setThreadNum(int numThreads) { numThreads_ = numThreads; }
+  void setTimerType(Worker::TimerType type) { timerType_ = type; }
+  void setDispatchPolicy(DispatchPolicy policy) { policy_ = policy; }
   void start(const ThreadInitCb& cb = ThreadInitCb());
+
+  // The loop of a new connection, according to the policy.
+  // Must be called in the base loop.
   Worker* getNextLoop();
 
+  // The I/O loops, or the base loop if there are no threads.
+  // Valid after start().
+  std::vector<Worker*> getAllLoops();
+
  private:
+  size_t nextIndex();
+  size_t leastConnectionsIndex();
+  size_t leastPendingBytesIndex();
+  size_t powerOfTwoChoicesIndex();
+  // xorshift32, good enough to draw loops.
+  uint32 random();
+
   Worker* baseLoop_;
   bool started_;
   int numThreads_;
+  Worker::TimerType timerType_;
   int next_;
+  DispatchPolicy policy_;
+  uint32 seed_;
   boost::ptr_vector<WorkerThread> threads_;
   std::vector<Worker*> loops_;
 
@@ -0,0 +1,103 @@
+#include "cobra/zero_copy_linger.h"
+
+#include <sys/socket.h>
+
+#include <boost/bind.hpp>
+
+#include "base/Logging.h"
+#include "cobra/block_chain.h"
+#include "cobra/socket_wrapper.h"
+#include "cobra/worker.h"
+
+namespace cobra {
+
+// Completions come in about a round trip after the send.
+const double ZeroCopyLinger::kPollSeconds = 0.01;
+const double ZeroCopyLinger::kMaxLingerSeconds = 30.0;
+
+ZeroCopyLinger::ZeroCopyLinger(Worker* loop)
+  : loop_(loop),
+    polling_(false) {
+}
+
+ZeroCopyLinger::~ZeroCopyLinger() {
+  // The loop is going away, with its timers.
+  for (size_t i = 0; i < sockets_.size(); ++i) {
+    reset(sockets_[i].fd);
+  }
+}
+
+void ZeroCopyLinger::add(int fd, const boost::shared_ptr<BlockChain>& pins) {
+  loop_->runInLoop(
+      boost::bind(&ZeroCopyLinger::addInLoop, this, fd, pins));
+}
+
+void ZeroCopyLinger::addInLoop(int fd,
+                               const boost::shared_ptr<BlockChain>& pins) {
+  loop_->assertInLoopThread();
+  Socket socket;
+  socket.fd = fd;
+  socket.pins = pins;
+  socket.deadline = addTime(Timestamp::now(), kMaxLingerSeconds);
+  if (drain(socket)) {
+    cobra::close(fd);
+    return;
+  }
+
+  sockets_.push_back(socket);
+  if (!polling_) {
+    timerId_ = loop_->runEvery(kPollSeconds,
+                               boost::bind(&ZeroCopyLinger::poll, this));
+    polling_ = true;
+  }
+}
+
+void ZeroCopyLinger::poll() {
+  loop_->assertInLoopThread();
+  const Timestamp now = Timestamp::now();
+  size_t kept = 0;
+  for (size_t i = 0; i < sockets_.size(); ++i) {
+    const Socket& socket = sockets_[i];
+    if (drain(socket)) {
+      cobra::close(socket.fd);
+    } else if (now >= socket.deadline) {
+      LOG_WARN << "ZeroCopyLinger - fd " << socket.fd << " still has "
+               << socket.pins->pinnedBlocks() << " blocks pinned after "
+               << kMaxLingerSeconds << "s, reset";
+      reset(socket.fd);
+    } else {
+      sockets_[kept++] = socket;
+    }
+  }
+  sockets_.resize(kept);
+
+  if (sockets_.empty()) {
+    loop_->cancel(timerId_);
+    polling_ = false;
+  }
+}
+
+bool ZeroCopyLinger::drain(const Socket& socket) {
+  uint32 lo = 0;
+  uint32 hi = 0;
+  bool copied = false;
+  int ret = 0;
+  while ((ret = RecvZeroCopyCompletion(socket.fd, &lo, &hi, &copied)) > 0) {
+    socket.pins->zeroCopyCompleted(lo, hi);
+  }
+  if (ret < 0) {
+    LOG_SYSERR << "ZeroCopyLinger::drain - fd " << socket.fd;
+  }
+  return socket.pins->pinnedBlocks() == 0;
+}
+
+void ZeroCopyLinger::reset(int fd) {
+  struct linger lingerOpt;
+  lingerOpt.l_onoff = 1;
+  lingerOpt.l_linger = 0;
+  ::setsockopt(fd, SOL_SOCKET, SO_LINGER,
+               &lingerOpt, static_cast<socklen_t>(sizeof lingerOpt));
+  cobra::close(fd);
+}
+
+}  // namespace cobra
@@ -0,0 +1,72 @@
+// Author: Jianbo Zhu
+//
+// Sockets closed with MSG_ZEROCOPY sends still in flight.
+
+#ifndef COBRA_ZERO_COPY_LINGER_H_
+#define COBRA_ZERO_COPY_LINGER_H_
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "base/macros.h"
+#include "base/timestamp.h"
+#include "cobra/timer_id.h"
+
+namespace cobra {
+
+class BlockChain;
+class Worker;
+
+// Keeps the socket of a destroyed connection open, with the blocks its
+// zerocopy sends pinned, until the kernel reported them all completed.
+// Closing first would free blocks the kernel still reads from.
+//
+// The error queues are polled by a timer, which only runs while some
+// socket lingers. A socket still waiting after kMaxLingerSeconds, eg.
+// its peer stopped reading, is reset, which drops its send queue.
+//
+// One per loop, @see Worker::zeroCopyLinger.
+class ZeroCopyLinger {
+ public:
+  explicit ZeroCopyLinger(Worker* loop);
+  // Resets the sockets still lingering.
+  ~ZeroCopyLinger();
+
+  // Takes 'fd' and the pins of 'pins', and closes 'fd' once they are
+  // all unpinned.
+  // Safe to call from other threads.
+  void add(int fd, const boost::shared_ptr<BlockChain>& pins);
+
+  size_t lingering() const { return sockets_.size(); }
+
+ private:
+  static const double kPollSeconds;
+  static const double kMaxLingerSeconds;
+
+  struct Socket {
+    int fd;
+    boost::shared_ptr<BlockChain> pins;
+    Timestamp deadline;
+  };
+
+  void addInLoop(int fd, const boost::shared_ptr<BlockChain>& pins);
+  // Run by the timer, drains the error queues.
+  void poll();
+  // @return true if all the sends of 'socket' completed
+  static bool drain(const Socket& socket);
+  // Closes with an RST, the kernel drops what is left to send.
+  static void reset(int fd);
+
+  Worker* loop_;
+  std::vector<Socket> sockets_;
+  // Valid while 'polling_'.
+  TimerId timerId_;
+  bool polling_;
+
+  DISABLE_COPY_AND_ASSIGN(ZeroCopyLinger);
+};
+
+}  // namespace cobra
+
+#endif  // COBRA_ZERO_COPY_LINGER_H_